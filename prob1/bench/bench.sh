@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# Throughput benchmark of prob1: generates synthetic corpora (gencorpus.c) and runs the counter
+# with every combination of corpus size, number of processes and chunk size, printing a CSV line
+# per run (MB/s, chunks/s, the busy time of the dispatcher and the workers, the chunk buffers in use and
+# the smallest and largest chunks, from --stats)
+#
+# Usage: bench/bench.sh [-s "<sizes>"] [-n "<processes>"] [-c "<chunk sizes>"] [-t <threads>]
+#                       [-a <accent density>] [-p <punctuation density>] [-r <repetitions>] [-w <work dir>]
+#
+# e.g. bench/bench.sh -s "64M 1G" -n "2 3 5 9" -c "4096 64k 1M auto" > results.csv
+#
+# The command that runs the MPI processes can be set with MPIEXEC (e.g. MPIEXEC="mpiexec --oversubscribe")
+#
+
+set -e
+
+sizes="1M 64M"
+processes="2 3 5"
+chunkSizes="4096 64k 1M auto"
+threads=1
+accents=0.1
+punctuation=0.15
+repetitions=1
+workDir=""
+mpiexec=${MPIEXEC:-mpiexec}
+
+while getopts "s:n:c:t:a:p:r:w:h" option; do
+    case $option in
+        s) sizes=$OPTARG ;;
+        n) processes=$OPTARG ;;
+        c) chunkSizes=$OPTARG ;;
+        t) threads=$OPTARG ;;
+        a) accents=$OPTARG ;;
+        p) punctuation=$OPTARG ;;
+        r) repetitions=$OPTARG ;;
+        w) workDir=$OPTARG ;;
+        *) sed -n '2,13p' "$0" | sed 's/^# \{0,1\}//'; exit 1 ;;
+    esac
+done
+
+# Build the counter and the generator in the work directory (the corpora are kept there too)
+sourceDir=$(cd "$(dirname "$0")/.." && pwd)
+if [ -z "$workDir" ]; then
+    workDir=$(mktemp -d)
+    trap 'rm -rf "$workDir"' EXIT
+fi
+mkdir -p "$workDir"
+
+mpicc -Wall -O3 -pthread -o "$workDir/main" "$sourceDir"/main.c "$sourceDir"/utils.c "$sourceDir"/simd.c \
+    "$sourceDir"/threads.c "$sourceDir"/pool.c "$sourceDir"/tuner.c "$sourceDir"/trace.c "$sourceDir"/words.c \
+    "$sourceDir"/classes.c "$sourceDir"/cache.c "$sourceDir"/decompress.c "$sourceDir"/metrics.c -lz
+cc -Wall -O3 -o "$workDir/gencorpus" "$sourceDir"/bench/gencorpus.c
+
+echo "size,bytes,processes,threads,chunk_size,repetition,seconds,mb_per_s,chunks_per_s,dispatcher_busy,workers_busy,buffers_hwm,chunk_min,chunk_max"
+
+for size in $sizes; do
+
+    corpus="$workDir/corpus-$size-$accents-$punctuation.txt"
+    if [ ! -f "$corpus" ]; then
+        "$workDir/gencorpus" -s "$size" -a "$accents" -p "$punctuation" -o "$corpus"
+    fi
+
+    for np in $processes; do
+        for chunkSize in $chunkSizes; do
+            for repetition in $(seq "$repetitions"); do
+
+                stats=$($mpiexec -n "$np" "$workDir/main" -c "$chunkSize" -t "$threads" --stats -f "$corpus" | grep "^STATS")
+
+                # key=value pairs of the STATS line
+                value() { echo "$stats" | tr ' ' '\n' | grep "^$1=" | cut -d= -f2; }
+
+                echo "$size,$(value bytes),$np,$threads,$chunkSize,$repetition,$(value seconds),$(value mb_per_s),$(value chunks_per_s),$(value dispatcher_busy),$(value workers_busy),$(value buffers_hwm),$(value chunk_min),$(value chunk_max)"
+
+            done
+        done
+    done
+
+done
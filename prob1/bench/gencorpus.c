@@ -0,0 +1,266 @@
+/**
+ * @file gencorpus.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Generator of synthetic Portuguese-like texts for the benchmarks of prob1
+ *
+ * The words are made of syllables (consonant and vowel), whose vowels are accented (á, ã, ê, ...) with a
+ * configurable probability, and are separated by spaces or by punctuation marks (ASCII and UTF-8 ones, like
+ * dashes, quotes and ellipses). The same size, densities and seed always generate the same text.
+ *
+ * Usage: ./gencorpus -s <size> [-a <accent density>] [-p <punctuation density>] [-r <seed>] [-o <file>]
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** \brief size of the output buffer (in bytes) */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+/** \brief largest corpus (in bytes) */
+#define MAX_CORPUS_SIZE (10ULL * 1024 * 1024 * 1024)
+
+/** \brief maximum number of syllables of a word */
+#define MAX_SYLLABLES 4
+
+/* Consonants and digraphs that start a syllable ("" is a syllable without consonant) */
+static const char *consonants[] = {
+    "", "", "b", "c", "d", "f", "g", "j", "l", "m", "n", "p", "r", "s", "t", "v", "x", "z",
+    "ch", "lh", "nh", "qu", "rr", "ss", "ç"
+};
+
+/* Vowels, without and with accents (vowel i of plainVowels has the accented forms accentedVowels[i]) */
+static const char *plainVowels[] = { "a", "e", "i", "o", "u" };
+static const char *accentedVowels[][4] = {
+    { "á", "à", "â", "ã" }, { "é", "ê", "é", "ê" }, { "í", "í", "í", "í" }, { "ó", "ô", "õ", "ó" }, { "ú", "ú", "ü", "ú" }
+};
+
+/* Punctuation marks, which are followed by a space or a newline */
+static const char *punctuation[] = {
+    ".", ",", ",", ";", ":", "!", "?", " -", " –", " —", "…", "\"", "»", "«", "“", "”", "(", ")", "[", "]"
+};
+
+/* Apostrophe in the middle of a word (e.g. "d'água"), which doesn't end it */
+static const char *apostrophes[] = { "'", "’" };
+
+/** \brief number of elements of an array */
+#define LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+
+/* State of the random number generator (xorshift64*) */
+static uint64_t randomState;
+
+/* Output buffer and number of bytes already written */
+static unsigned char buffer[OUTPUT_BUFFER_SIZE];
+static size_t bufferSize = 0;
+static uint64_t bytesWritten = 0;
+
+
+/**
+ * @brief Get the next random number (xorshift64*)
+ *
+ * @return random number
+ */
+static uint64_t nextRandom() {
+
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 0x2545F4914F6CDD1DULL;
+
+}
+
+
+/**
+ * @brief Get a random number between 0 and 1
+ *
+ * @return random number in [0, 1)
+ */
+static double randomUniform() {
+
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+
+}
+
+
+/**
+ * @brief Get a random index of an array
+ *
+ * @param length length of the array
+ * @return random index
+ */
+static size_t randomIndex(size_t length) {
+
+    return nextRandom() % length;
+
+}
+
+
+/**
+ * @brief Appends a string to the output buffer, writing the buffer if it's full
+ *
+ * @param output output file
+ * @param text string
+ */
+static void append(FILE *output, const char *text) {
+
+    size_t length = strlen(text);
+
+    if (bufferSize + length > OUTPUT_BUFFER_SIZE) {
+        fwrite(buffer, 1, bufferSize, output);
+        bytesWritten += bufferSize;
+        bufferSize = 0;
+    }
+    memcpy(buffer + bufferSize, text, length);
+    bufferSize += length;
+
+}
+
+
+/**
+ * @brief Parses a size with an optional suffix (k, M or G)
+ *
+ * @param text size (e.g. 64M or 1G)
+ * @return size (in bytes), 0 if it's not valid
+ */
+static uint64_t parseSize(const char *text) {
+
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+
+    return (*end == '\0') ? size : 0;
+
+}
+
+
+/**
+ * @brief prints the usage of the program
+ *
+ */
+static void usage() {
+    printf("Usage:\n\t./gencorpus -s <size> -a <accent density> -p <punctuation density> -r <seed> -o <file>\n\n");
+    printf("\t-s <size> : Size of the text (e.g. 1M, 64M or 10G, at most 10G)\n");
+    printf("\t-a <accent density> : Probability of an accented vowel (0-1, by default 0.1)\n");
+    printf("\t-p <punctuation density> : Probability of a punctuation mark after a word (0-1, by default 0.15)\n");
+    printf("\t-r <seed> : Seed of the random number generator (by default 1)\n");
+    printf("\t-o <file> : Output file (by default stdout)\n");
+}
+
+
+/**
+ * @brief Generates a text with (at least) the requested size, cut at the end of a word
+ *
+ * @param argc
+ * @param argv
+ * @return int
+ */
+int main(int argc, char *argv[]) {
+
+    uint64_t size = 0;
+    double accentDensity = 0.1, punctuationDensity = 0.15;
+    uint64_t seed = 1;
+    FILE *output = stdout;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:a:p:r:o:h")) != -1) {
+        switch (option) {
+            case 's':
+                size = parseSize(optarg);
+                break;
+            case 'a':
+                accentDensity = atof(optarg);
+                break;
+            case 'p':
+                punctuationDensity = atof(optarg);
+                break;
+            case 'r':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'o':
+                output = fopen(optarg, "wb");
+                if (output == NULL) {
+                    fprintf(stderr, "[ERROR] Can't create file %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            default:
+                fprintf(stderr, "Option Not Defined\n");
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (size == 0 || size > MAX_CORPUS_SIZE) {
+        fprintf(stderr, "Invalid size (must be > 0 and <= 10G)\n");
+        return EXIT_FAILURE;
+    }
+    if (accentDensity < 0 || accentDensity > 1 || punctuationDensity < 0 || punctuationDensity > 1) {
+        fprintf(stderr, "Invalid density (must be >= 0 and <= 1)\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The state of xorshift can't be 0 */
+    randomState = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    bool capitalize = true;
+
+    while (bytesWritten + bufferSize < size) {
+
+        /* Word: 1 to MAX_SYLLABLES syllables, sometimes with an apostrophe after the first one */
+        int syllables = 1 + randomIndex(MAX_SYLLABLES);
+        for (int i = 0; i < syllables; i++) {
+
+            const char *consonant = consonants[randomIndex(LENGTH(consonants))];
+            size_t vowel = randomIndex(LENGTH(plainVowels));
+
+            if (capitalize && consonant[0] >= 'a' && consonant[0] <= 'z') {
+                char upper[3] = { consonant[0] - 'a' + 'A', consonant[1], '\0' };
+                append(output, upper);
+            } else {
+                append(output, consonant);
+            }
+            capitalize = false;
+
+            if (randomUniform() < accentDensity) {
+                append(output, accentedVowels[vowel][randomIndex(4)]);
+            } else {
+                append(output, plainVowels[vowel]);
+            }
+
+            if (i == 0 && syllables > 1 && randomIndex(50) == 0) {
+                append(output, apostrophes[randomIndex(LENGTH(apostrophes))]);
+            }
+
+        }
+
+        /* Separator: a space, or a punctuation mark followed by a space or (sometimes) a new line */
+        if (randomUniform() < punctuationDensity) {
+            size_t mark = randomIndex(LENGTH(punctuation));
+            append(output, punctuation[mark]);
+            capitalize = (mark < 6);
+            append(output, (randomIndex(8) == 0) ? "\n" : " ");
+        } else {
+            append(output, " ");
+        }
+
+    }
+
+    fwrite(buffer, 1, bufferSize, output);
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,500 @@
+/**
+ * @file cache.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief On-disk cache of the results of the files (--cache), for incremental re-runs
+ *
+ * Each entry of the cache has the identity of a file (path, size and modification time), the hash of the character
+ * classes and the metrics (--metrics) it was counted with, the summary of the whole file before its end (so that appended bytes can be merged
+ * into it, like the next chunk) and the hashes of its blocks of CACHE_BLOCK_SIZE bytes (the last one may be partial).
+ *
+ * The dispatcher looks up the files before sending any chunk: an unchanged file isn't read at all, and a file that
+ * grew (e.g. a log) only has its new bytes processed, after its old blocks are hashed and compared. The hash is
+ * not cryptographic, it only tells if the old bytes were changed in place.
+ *
+ * File layout: a header (magic, version, block size and size of a summary) and the entries, each one with its
+ * fixed-size fields, its path and its block hashes. All the fields are in the byte order of the machine.
+ *
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "classes.h"
+#include "cache.h"
+
+/* Number of files to be processed */
+extern int numFiles;
+
+/* File structure declaration - will be used to store file related data (numWords, etc..) */
+extern struct fileInfo *files;
+
+/* Metrics selected with --metrics (0 if there are none) */
+extern int metricsMask;
+
+/**
+ * @brief Header of the cache file
+ *
+ */
+struct cacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t summarySize;       /* sizeof(struct chunkSummary), which changes with the layout of the summary */
+    uint32_t numEntries;
+};
+
+/**
+ * @brief Fixed-size fields of an entry of the cache (followed by pathLength bytes and numBlocks hashes)
+ *
+ */
+struct cacheRecord {
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t classesHash;       /* Hash of the character classes the file was counted with */
+    uint64_t numBlocks;
+    uint32_t pathLength;
+    uint32_t metricsMask;       /* Metrics the file was counted with (a file can only be used with these metrics or less) */
+    struct chunkSummary summary;    /* Summary of the whole file, before its end */
+};
+
+/**
+ * @brief Entry of the cache
+ *
+ */
+struct cacheEntry {
+    struct cacheRecord record;
+    char *path;
+    uint64_t *hashes;
+};
+
+/**
+ * @brief Identity of a file of this run and the entry of the cache it used
+ *
+ */
+struct fileLookup {
+    bool isRegular;             /* Only regular files are cached */
+    char *path;                 /* Absolute path (the key of the cache) */
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    int entry;                  /* Entry of the cache used by the file (-1 if none) */
+    uint64_t cachedBytes;       /* Bytes of the file whose summary came from the cache */
+};
+
+/* Magic of the cache file */
+static const char cacheMagic[8] = "P1CACHE";
+
+/* Entries of the cache */
+static struct cacheEntry *entries = NULL;
+static int numEntries = 0;
+
+/* Lookup of each file of this run */
+static struct fileLookup *lookups = NULL;
+
+/* Number of files of this run whose results (or part of them) came from the cache */
+static int cachedFiles = 0;
+
+
+/**
+ * @brief Get the hash of a range of bytes: 4 independent lanes of 8 bytes (multiply and xor-shift), so that
+ * hashing a block is much faster than processing it
+ *
+ * @param bytes bytes
+ * @param length number of bytes
+ * @return hash of the bytes
+ */
+static uint64_t hashBytes(const unsigned char *bytes, size_t length) {
+
+    uint64_t lanes[4] = { 0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL };
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * j, 8);
+            lanes[j] = (lanes[j] ^ word) * 0x100000001B3ULL;
+            lanes[j] ^= lanes[j] >> 29;
+        }
+    }
+
+    /* The lanes, the length and the last bytes (FNV-1a) */
+    uint64_t hash = 0xCBF29CE484222325ULL ^ length;
+    for (int j = 0; j < 4; j++) {
+        hash = (hash ^ lanes[j]) * 0x100000001B3ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+
+    return hash;
+
+}
+
+
+/**
+ * @brief Get the hash of the character classes (the results of a file depend on them)
+ *
+ * @return hash of the code point ranges of the classes
+ */
+static uint64_t hashCharClasses() {
+
+    int numRanges;
+    const struct classRange *ranges = getCharClassRanges(&numRanges);
+
+    return hashBytes((const unsigned char *) ranges, numRanges * sizeof(struct classRange));
+
+}
+
+
+/**
+ * @brief Hashes the blocks of a file from a block to a byte offset (the last block may be partial). With expected,
+ * the hashes are compared with it and the hashing stops at the first difference
+ *
+ * @param path path of the file
+ * @param firstBlock index of the first block
+ * @param end offset where the last block ends
+ * @param hashes hashes of the blocks, from firstBlock (set)
+ * @param expected hashes the blocks must have, from firstBlock (NULL to only hash them)
+ * @return true if all the blocks were read (and have the expected hashes)
+ */
+static bool hashFileBlocks(const char *path, uint64_t firstBlock, uint64_t end, uint64_t *hashes, const uint64_t *expected) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    unsigned char *buffer = (unsigned char *) malloc(CACHE_BLOCK_SIZE);
+    bool isValid = true;
+
+    for (uint64_t block = firstBlock, offset = firstBlock * CACHE_BLOCK_SIZE; isValid && offset < end; block++, offset += CACHE_BLOCK_SIZE) {
+
+        size_t length = (end - offset < CACHE_BLOCK_SIZE) ? end - offset : CACHE_BLOCK_SIZE;
+        size_t done = 0;
+        while (done < length) {
+            ssize_t bytesRead = pread(fd, buffer + done, length - done, offset + done);
+            if (bytesRead <= 0) {
+                break;
+            }
+            done += bytesRead;
+        }
+
+        if (done < length) {
+            isValid = false;
+        } else {
+            hashes[block - firstBlock] = hashBytes(buffer, length);
+            isValid = (expected == NULL || hashes[block - firstBlock] == expected[block - firstBlock]);
+        }
+
+    }
+
+    free(buffer);
+    close(fd);
+
+    return isValid;
+
+}
+
+
+/**
+ * @brief Frees the entries of the cache
+ *
+ */
+static void freeEntries() {
+
+    for (int i = 0; i < numEntries; i++) {
+        free(entries[i].path);
+        free(entries[i].hashes);
+    }
+    free(entries);
+    entries = NULL;
+    numEntries = 0;
+
+}
+
+
+/**
+ * @brief Loads the cache file (a missing file is an empty cache, an invalid one is ignored with a warning)
+ *
+ * @param filename cache file
+ */
+void loadResultCache(const char *filename) {
+
+    FILE *in = fopen(filename, "rb");
+    struct cacheHeader header;
+
+    if (in == NULL) {
+        return;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header.version != CACHE_VERSION || header.blockSize != CACHE_BLOCK_SIZE || header.summarySize != sizeof(struct chunkSummary)) {
+        printf("[WARNING] Ignoring the cache file %s (invalid, or written by another version)\n", filename);
+        fclose(in);
+        return;
+    }
+
+    bool isComplete = (header.numEntries <= MAX_CACHE_ENTRIES);
+    entries = (struct cacheEntry *) calloc(header.numEntries + 1, sizeof(struct cacheEntry));
+    for (uint32_t i = 0; isComplete && i < header.numEntries; i++) {
+
+        struct cacheEntry *entry = entries + numEntries;
+        if (fread(&entry->record, sizeof(struct cacheRecord), 1, in) != 1 || entry->record.pathLength > PATH_MAX ||
+            entry->record.numBlocks != (entry->record.fileSize + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE) {
+            isComplete = false;
+            break;
+        }
+
+        entry->path = (char *) calloc(entry->record.pathLength + 1, 1);
+        entry->hashes = (uint64_t *) malloc((entry->record.numBlocks + 1) * sizeof(uint64_t));
+        numEntries++;
+        isComplete = fread(entry->path, 1, entry->record.pathLength, in) == entry->record.pathLength &&
+                     fread(entry->hashes, sizeof(uint64_t), entry->record.numBlocks, in) == entry->record.numBlocks;
+
+    }
+
+    if (!isComplete) {
+        printf("[WARNING] Ignoring the cache file %s (truncated or corrupted)\n", filename);
+        freeEntries();
+    }
+    fclose(in);
+
+}
+
+
+/**
+ * @brief Looks up the files of this run in the cache, before their chunks are sent. A file with the same path, size
+ * and modification time (and character classes, and counted with at least the metrics of this run) gets its results
+ * from the cache and isn't read. A file that grew, and whose old bytes have the same block hashes, starts at the old
+ * end, with the summary of the old bytes (so the word and the UTF-8 sequence cut by the old end are put together).
+ * Streams (and compressed files) are never cached
+ *
+ * @return number of bytes of the files that don't have to be processed
+ */
+uint64_t applyResultCache() {
+
+    uint64_t classesHash = hashCharClasses();
+    uint64_t skippedBytes = 0;
+
+    lookups = (struct fileLookup *) calloc(numFiles, sizeof(struct fileLookup));
+
+    for (int i = 0; i < numFiles; i++) {
+
+        struct fileInfo *file = files + i;
+        struct fileLookup *lookup = lookups + i;
+        struct stat fileStat;
+
+        lookup->entry = -1;
+        if (strcmp(file->filename, "-") == 0 || file->compression != COMPRESSION_NONE ||
+            stat(file->filename, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+            continue;
+        }
+
+        lookup->isRegular = true;
+        lookup->path = realpath(file->filename, NULL);
+        if (lookup->path == NULL) {
+            lookup->path = strdup(file->filename);
+        }
+        lookup->mtimeSec = fileStat.st_mtim.tv_sec;
+        lookup->mtimeNsec = fileStat.st_mtim.tv_nsec;
+
+        for (int j = 0; j < numEntries && lookup->entry < 0; j++) {
+            if (entries[j].record.classesHash == classesHash && (entries[j].record.metricsMask & metricsMask) == (uint32_t) metricsMask &&
+                strcmp(entries[j].path, lookup->path) == 0) {
+                lookup->entry = j;
+            }
+        }
+        if (lookup->entry < 0) {
+            continue;
+        }
+
+        /* The same file, or the same bytes followed by new ones (only the old blocks are read) */
+        struct cacheEntry *entry = entries + lookup->entry;
+        uint64_t fileSize = fileStat.st_size;
+        if (entry->record.fileSize == fileSize && entry->record.mtimeSec == lookup->mtimeSec && entry->record.mtimeNsec == lookup->mtimeNsec) {
+            lookup->cachedBytes = fileSize;
+        } else if (entry->record.fileSize <= fileSize) {
+            uint64_t *hashes = (uint64_t *) malloc((entry->record.numBlocks + 1) * sizeof(uint64_t));
+            if (hashFileBlocks(lookup->path, 0, entry->record.fileSize, hashes, entry->hashes)) {
+                lookup->cachedBytes = entry->record.fileSize;
+            } else {
+                lookup->entry = -1;
+            }
+            free(hashes);
+        } else {
+            lookup->entry = -1;
+        }
+        if (lookup->entry < 0) {
+            continue;
+        }
+
+        /* The chunks of the new bytes are merged into the summary of the old ones */
+        file->summary = entry->record.summary;
+        file->offset = lookup->cachedBytes;
+        if (lookup->cachedBytes == fileSize) {
+            file->fileSize = fileSize;
+            file->isFinished = true;
+            finishFileSummary(file);
+        }
+        skippedBytes += lookup->cachedBytes;
+        cachedFiles++;
+
+    }
+
+    return skippedBytes;
+
+}
+
+
+/**
+ * @brief Writes an entry of the cache
+ *
+ * @param out cache file
+ * @param entry entry of the cache
+ * @return true if it was written
+ */
+static bool writeEntry(FILE *out, const struct cacheEntry *entry) {
+
+    return fwrite(&entry->record, sizeof(struct cacheRecord), 1, out) == 1 &&
+           fwrite(entry->path, 1, entry->record.pathLength, out) == entry->record.pathLength &&
+           fwrite(entry->hashes, sizeof(uint64_t), entry->record.numBlocks, out) == entry->record.numBlocks;
+
+}
+
+
+/**
+ * @brief Adds the results of the files of this run (all of their chunks were merged) to the cache and writes it
+ * (the entries of the files that weren't in this run are kept). The blocks that weren't verified are hashed
+ *
+ * @param filename cache file
+ * @return 0, -1 if the cache file can't be written (the error is printed)
+ */
+int saveResultCache(const char *filename) {
+
+    uint64_t classesHash = hashCharClasses();
+    struct cacheEntry *newEntries = (struct cacheEntry *) calloc(numFiles + 1, sizeof(struct cacheEntry));
+    int numNewEntries = 0;
+
+    /* Entries of the files of this run (a file given twice is only added once) */
+    for (int i = 0; i < numFiles; i++) {
+
+        struct fileInfo *file = files + i;
+        struct fileLookup *lookup = lookups + i;
+        bool isDuplicate = false;
+
+        for (int j = 0; j < numNewEntries && lookup->isRegular; j++) {
+            isDuplicate |= (strcmp(newEntries[j].path, lookup->path) == 0);
+        }
+        if (!lookup->isRegular || file->isStream || isDuplicate) {
+            continue;
+        }
+
+        struct cacheEntry *entry = newEntries + numNewEntries;
+        entry->record.fileSize = file->fileSize;
+        entry->record.mtimeSec = lookup->mtimeSec;
+        entry->record.mtimeNsec = lookup->mtimeNsec;
+        entry->record.classesHash = classesHash;
+        entry->record.numBlocks = (file->fileSize + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE;
+        entry->record.pathLength = strlen(lookup->path);
+        /* A file that wasn't read at all still has the metrics of its entry */
+        entry->record.metricsMask = (lookup->entry >= 0 && lookup->cachedBytes == file->fileSize) ? entries[lookup->entry].record.metricsMask : (uint32_t) metricsMask;
+        entry->record.summary = file->summary;
+        entry->path = lookup->path;
+        entry->hashes = (uint64_t *) malloc((entry->record.numBlocks + 1) * sizeof(uint64_t));
+
+        /* The hashes of the full blocks of the cached bytes are known, the other blocks are read */
+        uint64_t knownBlocks = 0;
+        if (lookup->entry >= 0) {
+            knownBlocks = (lookup->cachedBytes == file->fileSize) ? entry->record.numBlocks : lookup->cachedBytes / CACHE_BLOCK_SIZE;
+            memcpy(entry->hashes, entries[lookup->entry].hashes, knownBlocks * sizeof(uint64_t));
+        }
+        if (!hashFileBlocks(lookup->path, knownBlocks, file->fileSize, entry->hashes + knownBlocks, NULL)) {
+            free(entry->hashes);
+            continue;
+        }
+        numNewEntries++;
+
+    }
+
+    /* The old entries that weren't replaced are kept */
+    int numKept = 0;
+    bool *isKept = (bool *) calloc(numEntries + 1, sizeof(bool));
+    for (int i = 0; i < numEntries; i++) {
+        isKept[i] = true;
+        for (int j = 0; j < numNewEntries; j++) {
+            if (entries[i].record.classesHash == classesHash && strcmp(entries[i].path, newEntries[j].path) == 0) {
+                isKept[i] = false;
+            }
+        }
+        numKept += isKept[i];
+    }
+
+    /* The cache is written into another file, which replaces it once it's complete */
+    char *tempName = (char *) malloc(strlen(filename) + 5);
+    sprintf(tempName, "%s.tmp", filename);
+    FILE *out = fopen(tempName, "wb");
+    bool isWritten = (out != NULL);
+
+    struct cacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = CACHE_VERSION;
+    header.blockSize = CACHE_BLOCK_SIZE;
+    header.summarySize = sizeof(struct chunkSummary);
+    header.numEntries = numKept + numNewEntries;
+
+    isWritten = isWritten && fwrite(&header, sizeof(header), 1, out) == 1;
+    for (int i = 0; isWritten && i < numEntries; i++) {
+        isWritten = !isKept[i] || writeEntry(out, entries + i);
+    }
+    for (int i = 0; isWritten && i < numNewEntries; i++) {
+        isWritten = writeEntry(out, newEntries + i);
+    }
+    if (out != NULL) {
+        isWritten = (fclose(out) == 0) && isWritten;
+    }
+    isWritten = isWritten && rename(tempName, filename) == 0;
+    if (!isWritten) {
+        printf("[ERROR] Can't write the cache file %s\n", filename);
+        remove(tempName);
+    }
+
+    for (int i = 0; i < numNewEntries; i++) {
+        free(newEntries[i].hashes);
+    }
+    for (int i = 0; i < numFiles; i++) {
+        free(lookups[i].path);
+    }
+    free(newEntries);
+    free(isKept);
+    free(tempName);
+    free(lookups);
+    lookups = NULL;
+    freeEntries();
+
+    return isWritten ? 0 : -1;
+
+}
+
+
+/**
+ * @brief Get the number of files of this run whose results (or part of them) came from the cache
+ *
+ * @return number of files
+ */
+int getCachedFiles() {
+
+    return cachedFiles;
+
+}
@@ -0,0 +1,48 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the on-disk cache of the results of the files (--cache), used by the dispatcher.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef CACHE_H
+#define CACHE_H
+
+/**
+ * @brief Loads the cache file (a missing file is an empty cache, an invalid one is ignored with a warning)
+ *
+ * @param filename cache file
+ */
+extern void loadResultCache(const char *filename);
+
+/**
+ * @brief Looks up the files of this run in the cache, before their chunks are sent. A file with the same path, size
+ * and modification time (and character classes, and counted with at least the metrics of this run) gets its results
+ * from the cache and isn't read. A file that grew, and whose old bytes have the same block hashes, starts at the old
+ * end, with the summary of the old bytes (so the word and the UTF-8 sequence cut by the old end are put together).
+ * Streams (and compressed files) are never cached
+ *
+ * @return number of bytes of the files that don't have to be processed
+ */
+extern uint64_t applyResultCache();
+
+/**
+ * @brief Adds the results of the files of this run (all of their chunks were merged) to the cache and writes it
+ * (the entries of the files that weren't in this run are kept). The blocks that weren't verified are hashed
+ *
+ * @param filename cache file
+ * @return 0, -1 if the cache file can't be written (the error is printed)
+ */
+extern int saveResultCache(const char *filename);
+
+/**
+ * @brief Get the number of files of this run whose results (or part of them) came from the cache
+ *
+ * @return number of files
+ */
+extern int getCachedFiles();
+
+#endif /* CACHE_H */
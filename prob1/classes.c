@@ -0,0 +1,489 @@
+/**
+ * @file classes.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Character classes (--classes), compiled into a byte-level DFA
+ *
+ * The classes (the 6 vowels, separators and apostrophes, any other character is CHAR_CLASS_OTHER) are read
+ * from a spec file, one class per line:
+ *
+ *      # Portuguese
+ *      a: aAàáâãäåæÀÁÂÃÄÅÆ
+ *      separator: \s \t \n \r ! " ( ) , - . : ; ? [ ] _ ¨ « » – — “ ” …
+ *      apostrophe: ' ` ‘ ’ U+02BC
+ *
+ * The class names are a, e, i, o, u, y, separator and apostrophe. The characters of a class are written in UTF-8
+ * (\s is a space, \t, \n and \r are the control characters, \# and \\ are # and \), or as code points (U+00E1)
+ * and ranges of code points (U+0300-U+036F). A character can only be in one class.
+ *
+ * The classes are compiled into a lookup table of the code points below U+0800 (the ones that have one or two
+ * bytes) and a DFA that decodes and classifies UTF-8 in a single table walk: each byte is a transition, which
+ * completes 0, 1 or 2 characters. The states are the prefixes of the UTF-8 sequences, but a prefix whose characters
+ * all have the same class is a shared state that only skips its continuation bytes, so the DFA stays small no
+ * matter how many classes and characters are configured. The invalid sequences are decoded like decodeUTF8() does.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "classes.h"
+
+/* Classes used when no spec file is given (Portuguese) */
+static const char *defaultClasses =
+    "a: aAàáâãäåæÀÁÂÃÄÅÆ\n"
+    "e: eEèéêëÈÉÊË\n"
+    "i: iIìíîïÌÍÎÏ\n"
+    "o: oOòóôõöøÒÓÔÕÖØ\n"
+    "u: uUùúûüÙÚÛÜ\n"
+    "y: yYýÿÝ\n"
+    "separator: \\s \\t \\n \\r ! \" ( ) , - . : ; ? [ ] _ ¨ « » – — “ ” …\n"
+    "apostrophe: ' ` ‘ ’\n";
+
+/* Names of the classes in the spec files (indexed by CHAR_CLASS_*) */
+static const char *classNames[CHAR_CLASS_OTHER] = { "a", "e", "i", "o", "u", "y", "separator", "apostrophe" };
+
+/* Code point ranges of the classes, sorted (the consecutive ranges of the same class are joined) */
+static struct classRange classRanges[MAX_CLASS_RANGES];
+static int numClassRanges = 0;
+
+/* Class of the code points below U+0800 */
+static unsigned char lowClass[0x800];
+
+/* Transitions of the DFA (256 per state) */
+uint32_t *classDFA = NULL;
+static int numStates = 0;
+
+/* Shared states that skip the remaining continuation bytes of a character of a class (0 if not created yet) */
+static int skipStates[CHAR_CLASS_OTHER + 1][4];
+
+
+/**
+ * @brief Compares two code point ranges by their first code point (qsort)
+ *
+ * @param a range
+ * @param b range
+ * @return < 0 if a comes first, > 0 if b comes first
+ */
+static int compareRanges(const void *a, const void *b) {
+
+    const struct classRange *x = (const struct classRange *) a;
+    const struct classRange *y = (const struct classRange *) b;
+
+    return (x->first > y->first) - (x->first < y->first);
+
+}
+
+
+/**
+ * @brief Get the class of all the code points of an interval
+ *
+ * @param first first code point
+ * @param last last code point
+ * @return class of the code points, -1 if they don't have the same class
+ */
+static int getIntervalClass(unsigned int first, unsigned int last) {
+
+    /* First range that ends at or after the first code point */
+    int low = 0, high = numClassRanges;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (classRanges[middle].last < first) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == numClassRanges || classRanges[low].first > last) {
+        return CHAR_CLASS_OTHER;
+    }
+    if (classRanges[low].first <= first && classRanges[low].last >= last) {
+        return classRanges[low].charClass;
+    }
+    return -1;
+
+}
+
+
+/**
+ * @brief Retrieves the class of a character ('a','e','i','o','u','y',<separation/whitespace/punctiation>,<apostrophe>,<other>)
+ * through the lookup tables compiled from the character classes
+ *
+ * @param codePoint Unicode code point of the character
+ * @return
+ *  CHAR_CLASS_A to CHAR_CLASS_Y (0 to 5) if it's a vowel
+ *  CHAR_CLASS_SEPARATOR if SEPARATION, WHITESPACE or PUNCTUATION
+ *  CHAR_CLASS_APOSTROPHE if it's an apostrophe (does not end a word)
+ *  CHAR_CLASS_OTHER if other character (consonant)
+ */
+int getCharClass(unsigned int codePoint) {
+
+    if (codePoint < 0x800) {
+        return lowClass[codePoint];
+    }
+
+    return getIntervalClass(codePoint, codePoint);
+
+}
+
+
+/**
+ * @brief Adds a state to the DFA (its transitions are set by the caller). The table may be moved, so a
+ * transition is always computed before it's stored
+ *
+ * @return index of the state
+ */
+static int addState() {
+
+    if (numStates == MAX_CLASS_DFA_STATES) {
+        printf("[ERROR] Too many character classes (the DFA has more than %d states)\n", MAX_CLASS_DFA_STATES);
+        exit(1);
+    }
+
+    classDFA = (uint32_t *) realloc(classDFA, (numStates + 1) * 256 * sizeof(uint32_t));
+    if (classDFA == NULL) {
+        printf("[ERROR] Can't allocate memory for the character classes\n");
+        exit(1);
+    }
+    memset(classDFA + numStates * 256, 0, 256 * sizeof(uint32_t));
+
+    return numStates++;
+
+}
+
+
+/**
+ * @brief Get the transition that completes a character and goes to a state
+ *
+ * @param charClass class of the character
+ * @param state next state
+ * @return transition
+ */
+static uint32_t completeCharacter(int charClass, int state) {
+
+    return ((uint32_t) (charClass + 1) << 16) | state;
+
+}
+
+
+/**
+ * @brief Adds the states of the prefix of the UTF-8 sequences of the code points first to first + 64^remaining - 1,
+ * which are followed by remaining continuation bytes. The continuation bytes of a prefix whose code points have the
+ * same class are only skipped (shared state). The transitions of the other bytes are set by compileCharClasses()
+ *
+ * @param first first code point of the prefix
+ * @param remaining number of continuation bytes after the prefix (1 to 3)
+ * @return state of the prefix
+ */
+static int addPrefixState(unsigned int first, int remaining) {
+
+    unsigned int span = 1u << (6 * remaining);
+    int charClass = getIntervalClass(first, first + span - 1);
+    int state;
+
+    if (charClass >= 0) {
+        if (skipStates[charClass][remaining] != 0) {
+            return skipStates[charClass][remaining];
+        }
+        state = addState();
+        skipStates[charClass][remaining] = state;
+        for (int byte = 0x80; byte < 0xC0; byte++) {
+            uint32_t transition = (remaining == 1) ? completeCharacter(charClass, 0) : (uint32_t) addPrefixState(first, remaining - 1);
+            classDFA[state * 256 + byte] = transition;
+        }
+        return state;
+    }
+
+    state = addState();
+    for (int byte = 0x80; byte < 0xC0; byte++) {
+        unsigned int codePoint = first + (byte & 0x3F) * (span >> 6);
+        uint32_t transition = (remaining == 1) ? completeCharacter(getCharClass(codePoint), 0) : (uint32_t) addPrefixState(codePoint, remaining - 1);
+        classDFA[state * 256 + byte] = transition;
+    }
+
+    return state;
+
+}
+
+
+/**
+ * @brief Compiles the lookup table of the code points below U+0800 and the DFA from the code point ranges
+ *
+ */
+static void compileCharClasses() {
+
+    for (unsigned int codePoint = 0; codePoint < 0x800; codePoint++) {
+        lowClass[codePoint] = CHAR_CLASS_OTHER;
+    }
+    for (int r = 0; r < numClassRanges && classRanges[r].first < 0x800; r++) {
+        for (unsigned int codePoint = classRanges[r].first; codePoint <= classRanges[r].last && codePoint < 0x800; codePoint++) {
+            lowClass[codePoint] = classRanges[r].charClass;
+        }
+    }
+
+    free(classDFA);
+    classDFA = NULL;
+    numStates = 0;
+    memset(skipStates, 0, sizeof(skipStates));
+
+    /* Start of a character: ASCII, a continuation byte (an invalid character by itself) or the first byte of a sequence */
+    int start = addState();
+    int invalidClass = getCharClass(UTF8_REPLACEMENT_CHAR);
+    for (int byte = 0; byte < 256; byte++) {
+        uint32_t transition;
+        if (byte < 0x80) {
+            transition = completeCharacter(lowClass[byte], 0);
+        } else if (byte < 0xC0) {
+            transition = completeCharacter(invalidClass, 0);
+        } else if (byte < 0xE0) {
+            transition = addPrefixState((byte & 0x1F) << 6, 1);
+        } else if (byte < 0xF0) {
+            transition = addPrefixState((byte & 0x0F) << 12, 2);
+        } else {
+            transition = addPrefixState((byte & 0x07) << 18, 3);
+        }
+        classDFA[start * 256 + byte] = transition;
+    }
+
+    /* A sequence ended before its last continuation byte is an invalid character, and the byte starts the next one */
+    for (int state = 1; state < numStates; state++) {
+        for (int byte = 0; byte < 256; byte++) {
+            if (byte < 0x80 || byte >= 0xC0) {
+                uint32_t next = classDFA[start * 256 + byte];
+                classDFA[state * 256 + byte] = completeCharacter(invalidClass, CLASS_DFA_STATE(next)) | (CLASS_DFA_FIRST(next) << 20);
+            }
+        }
+    }
+
+}
+
+
+/**
+ * @brief Sets the character classes (e.g. received from the dispatcher) and compiles the lookup tables and the DFA
+ *
+ * @param ranges code point ranges of the classes (sorted, without overlaps)
+ * @param numRanges number of ranges
+ */
+void setCharClasses(const struct classRange *ranges, int numRanges) {
+
+    memcpy(classRanges, ranges, numRanges * sizeof(struct classRange));
+    numClassRanges = numRanges;
+    compileCharClasses();
+
+}
+
+
+/**
+ * @brief Get the code point ranges of the character classes (the ones not in a range are CHAR_CLASS_OTHER)
+ *
+ * @param numRanges number of ranges (set)
+ * @return ranges, sorted
+ */
+const struct classRange *getCharClassRanges(int *numRanges) {
+
+    *numRanges = numClassRanges;
+    return classRanges;
+
+}
+
+
+/**
+ * @brief Parses a code point written as U+XXXX
+ *
+ * @param text text (updated to the end of the code point)
+ * @param codePoint code point (set)
+ * @return true if it's valid
+ */
+static bool parseCodePoint(const char **text, unsigned int *codePoint) {
+
+    char *end;
+
+    if (((*text)[0] != 'U' && (*text)[0] != 'u') || (*text)[1] != '+') {
+        return false;
+    }
+    *codePoint = strtoul(*text + 2, &end, 16);
+    if (end == *text + 2 || *codePoint > 0x1FFFFF || (*end != '\0' && strchr(" \t\r\n#-", *end) == NULL)) {
+        return false;
+    }
+    *text = end;
+    return true;
+
+}
+
+
+/**
+ * @brief Parses the character classes of a spec (see the top of this file) into classRanges
+ *
+ * @param spec text of the spec
+ * @param source name of the spec (for the errors)
+ * @return 0, -1 if the spec isn't valid (the error is printed)
+ */
+static int parseCharClasses(const char *spec, const char *source) {
+
+    struct classRange *ranges = classRanges;
+    int numRanges = 0;
+    int lineNumber = 0;
+
+    for (const char *line = spec; *line != '\0'; ) {
+
+        const char *lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL) {
+            lineEnd = line + strlen(line);
+        }
+        lineNumber++;
+
+        /* Class name (the line is skipped if it's empty or a comment) */
+        const char *p = line;
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        if (p == lineEnd || *p == '#') {
+            line = (*lineEnd == '\0') ? lineEnd : lineEnd + 1;
+            continue;
+        }
+        const char *colon = memchr(p, ':', lineEnd - p);
+        int charClass = -1;
+        for (int c = 0; colon != NULL && c < CHAR_CLASS_OTHER; c++) {
+            const char *nameEnd = colon;
+            while (nameEnd > p && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) {
+                nameEnd--;
+            }
+            if (strlen(classNames[c]) == (size_t) (nameEnd - p) && strncmp(classNames[c], p, nameEnd - p) == 0) {
+                charClass = c;
+            }
+        }
+        if (charClass < 0) {
+            printf("[ERROR] %s:%d: expected <class>: <characters>, where class is a, e, i, o, u, y, separator or apostrophe\n", source, lineNumber);
+            return -1;
+        }
+
+        /* Characters and code points of the class, until the end of the line or a comment */
+        for (p = colon + 1; p < lineEnd && *p != '#'; ) {
+
+            unsigned int first, last;
+            const unsigned char *bytes = (const unsigned char *) p;
+
+            if (*p == ' ' || *p == '\t' || *p == '\r') {
+                p++;
+                continue;
+            }
+
+            if ((*p == 'U' || *p == 'u') && p + 1 < lineEnd && p[1] == '+') {
+                if (!parseCodePoint(&p, &first)) {
+                    printf("[ERROR] %s:%d: invalid code point (must be U+0000 to U+1FFFFF)\n", source, lineNumber);
+                    return -1;
+                }
+                last = first;
+                if (*p == '-') {
+                    p++;
+                    if (!parseCodePoint(&p, &last) || last < first) {
+                        printf("[ERROR] %s:%d: invalid range of code points (must be U+XXXX-U+YYYY)\n", source, lineNumber);
+                        return -1;
+                    }
+                }
+            } else if (*p == '\\' && p + 1 < lineEnd) {
+                switch (p[1]) {
+                    case 's': first = ' '; break;
+                    case 't': first = '\t'; break;
+                    case 'n': first = '\n'; break;
+                    case 'r': first = '\r'; break;
+                    case '\\': case '#': first = p[1]; break;
+                    default:
+                        printf("[ERROR] %s:%d: invalid escape \\%c\n", source, lineNumber, p[1]);
+                        return -1;
+                }
+                last = first;
+                p += 2;
+            } else {
+                int length = getCharLength(bytes, lineEnd - p);
+                if (p + length > lineEnd || (first = decodeUTF8(bytes, length)) == UTF8_REPLACEMENT_CHAR) {
+                    printf("[ERROR] %s:%d: invalid UTF-8 character\n", source, lineNumber);
+                    return -1;
+                }
+                last = first;
+                p += length;
+            }
+
+            if (numRanges == MAX_CLASS_RANGES) {
+                printf("[ERROR] %s:%d: too many characters (at most %d ranges)\n", source, lineNumber, MAX_CLASS_RANGES);
+                return -1;
+            }
+            ranges[numRanges].first = first;
+            ranges[numRanges].last = last;
+            ranges[numRanges].charClass = charClass;
+            numRanges++;
+
+        }
+
+        line = (*lineEnd == '\0') ? lineEnd : lineEnd + 1;
+
+    }
+
+    /* Sort the ranges, which can't overlap, and join the consecutive ranges of the same class */
+    qsort(ranges, numRanges, sizeof(struct classRange), compareRanges);
+    int count = 0;
+    for (int r = 0; r < numRanges; r++) {
+        if (count > 0 && ranges[r].first <= ranges[count - 1].last) {
+            printf("[ERROR] %s: U+%04X is in more than one class\n", source, ranges[r].first);
+            return -1;
+        }
+        if (count > 0 && ranges[r].first == ranges[count - 1].last + 1 && ranges[r].charClass == ranges[count - 1].charClass) {
+            ranges[count - 1].last = ranges[r].last;
+        } else {
+            ranges[count++] = ranges[r];
+        }
+    }
+    numClassRanges = count;
+
+    return 0;
+
+}
+
+
+/**
+ * @brief Loads the character classes from a spec file (or the default ones, for Portuguese) and compiles them
+ *
+ * @param filename spec file (NULL for the default classes)
+ * @return 0, -1 if the file can't be read or isn't valid (the error is printed)
+ */
+int loadCharClasses(const char *filename) {
+
+    if (filename == NULL) {
+        parseCharClasses(defaultClasses, "default classes");
+        compileCharClasses();
+        return 0;
+    }
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("[ERROR] Can't open file %s\n", filename);
+        return -1;
+    }
+
+    /* The spec is small, it's read at once */
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *spec = (char *) malloc(size + 1);
+    if (spec == NULL || fread(spec, 1, size, file) != (size_t) size) {
+        printf("[ERROR] Can't read file %s\n", filename);
+        fclose(file);
+        free(spec);
+        return -1;
+    }
+    spec[size] = '\0';
+    fclose(file);
+
+    int status = parseCharClasses(spec, filename);
+    free(spec);
+    if (status == 0) {
+        compileCharClasses();
+    }
+
+    return status;
+
+}
@@ -0,0 +1,77 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the character classes (--classes), compiled into a byte-level DFA.
+ *
+ */
+
+#include <stdint.h>
+
+#ifndef CLASSES_H
+#define CLASSES_H
+
+/**
+ * @brief Range of code points of a character class
+ *
+ */
+struct classRange {
+    unsigned int first;
+    unsigned int last;
+    int charClass;
+};
+
+/**
+ * @brief Transitions of the DFA that decodes and classifies UTF-8 (classDFA[state * 256 + byte]). A transition has
+ * the next state (CLASS_DFA_STATE) and the classes of the characters it completes, 0, 1 or 2 (when an incomplete
+ * sequence is ended by the first byte of another character): CLASS_DFA_FIRST and CLASS_DFA_SECOND (class + 1, 0 if none)
+ *
+ */
+extern uint32_t *classDFA;
+
+/** \brief next state of a transition of classDFA (state 0 is the start of a character) */
+#define CLASS_DFA_STATE(transition) ((transition) & 0xFFFF)
+
+/** \brief class + 1 of the first character completed by a transition of classDFA (0 if none) */
+#define CLASS_DFA_FIRST(transition) (((transition) >> 16) & 0x0F)
+
+/** \brief class + 1 of the second character completed by a transition of classDFA (0 if none) */
+#define CLASS_DFA_SECOND(transition) ((transition) >> 20)
+
+/**
+ * @brief Loads the character classes from a spec file (or the default ones, for Portuguese) and compiles them
+ *
+ * @param filename spec file (NULL for the default classes)
+ * @return 0, -1 if the file can't be read or isn't valid (the error is printed)
+ */
+extern int loadCharClasses(const char *filename);
+
+/**
+ * @brief Sets the character classes (e.g. received from the dispatcher) and compiles the lookup tables and the DFA
+ *
+ * @param ranges code point ranges of the classes (sorted, without overlaps)
+ * @param numRanges number of ranges
+ */
+extern void setCharClasses(const struct classRange *ranges, int numRanges);
+
+/**
+ * @brief Get the code point ranges of the character classes (the ones not in a range are CHAR_CLASS_OTHER)
+ *
+ * @param numRanges number of ranges (set)
+ * @return ranges, sorted
+ */
+extern const struct classRange *getCharClassRanges(int *numRanges);
+
+/**
+ * @brief Retrieves the class of a character ('a','e','i','o','u','y',<separation/whitespace/punctiation>,<apostrophe>,<other>)
+ * through the lookup tables compiled from the character classes
+ *
+ * @param codePoint Unicode code point of the character
+ * @return
+ *  CHAR_CLASS_A to CHAR_CLASS_Y (0 to 5) if it's a vowel
+ *  CHAR_CLASS_SEPARATOR if SEPARATION, WHITESPACE or PUNCTUATION
+ *  CHAR_CLASS_APOSTROPHE if it's an apostrophe (does not end a word)
+ *  CHAR_CLASS_OTHER if other character (consonant)
+ */
+extern int getCharClass(unsigned int codePoint);
+
+#endif /* CLASSES_H */
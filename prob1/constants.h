@@ -10,11 +10,102 @@
 #define CONSTANTS_H
 
 
-/** \brief maximum number of files allowed */
-#define MAX_NUM_FILES 10
+/** \brief maximum number of threads per worker */
+#define MAX_NUM_THREADS 128
 
-/** \brief maximum number of files allowed */
-#define MAX_NUM_THREADS 8
+/** \brief maximum number of chunks in flight per worker */
+#define MAX_PIPELINE_DEPTH 256
+
+/** \brief maximum memory (in bytes) of the chunk buffers of a worker (-d buffers of the -c chunk size, allocated once) */
+#define MAX_WORKER_BUFFER_BYTES (1024 * 1024 * 1024)
+
+/** \brief smallest and largest chunk sizes (in bytes) accepted by -c */
+#define MIN_CHUNK_SIZE 1024
+#define MAX_CHUNK_SIZE (64 * 1024 * 1024)
+
+/** \brief largest super-chunk (in bytes) sent by rank 0 to a node dispatcher, which splits it among the workers of its node */
+#define MAX_SUPER_CHUNK_SIZE (256 * 1024 * 1024)
+
+/** \brief default chunk size (in bytes) */
+#define DEFAULT_CHUNK_SIZE 4096
+
+/** \brief chunk sizes (in bytes) with -c auto: size of the first chunks, smallest and largest chunks */
+#define AUTO_INITIAL_CHUNK_SIZE (64 * 1024)
+#define AUTO_MIN_CHUNK_SIZE (16 * 1024)
+#define AUTO_MAX_CHUNK_SIZE (8 * 1024 * 1024)
+
+/** \brief processing time (in seconds) of a chunk with -c auto */
+#define AUTO_TARGET_CHUNK_TIME 0.01
+
+/** \brief with -c auto, a chunk takes at least AUTO_WAIT_RATIO times the time a worker waits for it */
+#define AUTO_WAIT_RATIO 10
+
+/** \brief with -c auto, a chunk has at most 1 / AUTO_TAIL_FACTOR of a worker's share of the bytes left */
+#define AUTO_TAIL_FACTOR 2
+
+/** \brief weight of a new measure in the moving averages of the chunk size tuning */
+#define AUTO_SMOOTHING 0.25
+
+/** \brief default interval (in seconds) of the running totals of the streams */
+#define RUNNING_TOTALS_INTERVAL 1.0
+
+/** \brief alignment (in bytes) of the buffers of a bufferPool */
+#define POOL_ALIGNMENT 64
+
+/** \brief bytes reserved for the header of a chunk message at the start of a buffer (so that the chunk stays aligned) */
+#define CHUNK_HEADER_SPACE 64
+
+/** \brief minimum number of bytes processed by a thread of a worker at a time */
+#define MIN_BYTES_PER_THREAD 4096
+
+/** \brief number of ranges per thread of the single-process version (smp) when the size of the ranges is auto */
+#define SMP_RANGES_PER_THREAD 16
+
+/** \brief counters of each file kept by the workers and reduced at the end (the words and the words with each vowel), followed by the NUM_METRIC_COUNTERS counters of the metrics with --metrics */
+#define NUM_FILE_COUNTERS 7
+
+/** \brief metrics of the fused pass (--metrics), a bitmask: letter frequencies, word lengths, occurrences of each vowel and sentences */
+#define METRIC_LETTERS 1
+#define METRIC_LENGTHS 2
+#define METRIC_VOWELS 4
+#define METRIC_SENTENCES 8
+#define METRIC_ALL 15
+
+/** \brief longest word length (in characters) with its own bin in the word length distribution, the longer words are in its bin */
+#define MAX_WORD_LENGTH 20
+
+/** \brief index of the first counter of each metric in a textMetrics structure: letters 'a' to 'z', occurrences of each vowel class, words of each length and sentences */
+#define METRIC_COUNTER_LETTERS 0
+#define METRIC_COUNTER_VOWELS 26
+#define METRIC_COUNTER_LENGTHS 32
+#define METRIC_COUNTER_SENTENCES (METRIC_COUNTER_LENGTHS + MAX_WORD_LENGTH)
+
+/** \brief number of counters of a textMetrics structure, rounded up to whole cache lines (8 counters of 8 bytes) */
+#define NUM_METRIC_COUNTERS 56
+
+/** \brief size (in bytes) of a cache line, the alignment of the counters of the fused pass */
+#define CACHE_LINE_SIZE 64
+
+/** \brief bytes of the blocks of a file hashed by the cache (--cache), to tell if the cached bytes of a file that grew were changed */
+#define CACHE_BLOCK_SIZE (1024 * 1024)
+
+/** \brief version of the layout of the cache file (a cache file of another version is ignored) */
+#define CACHE_VERSION 2
+
+/** \brief maximum number of files in the cache */
+#define MAX_CACHE_ENTRIES (1024 * 1024)
+
+/** \brief maximum number of bytes of a (normalised) word counted by --top, longer words are cut (at a character) */
+#define MAX_WORD_BYTES 64
+
+/** \brief maximum number of most frequent words printed per file (--top) */
+#define MAX_TOP_WORDS 100
+
+/** \brief maximum number of code point ranges of the character classes (--classes) */
+#define MAX_CLASS_RANGES 4096
+
+/** \brief maximum number of states of the DFA compiled from the character classes (256 transitions of 4 bytes each) */
+#define MAX_CLASS_DFA_STATES 4096
 
 /** \brief indicates if all files have been processed*/
 #define ALL_FILES_PROCESSED 0
@@ -31,5 +122,54 @@
 /** \brief MPI tag to inform the work is done */
 #define MPI_TAG_END_WORK 3
 
+/** \brief MPI tag to identify a message with a chunk (and its size and file index) sent to a worker */
+#define MPI_TAG_SEND_CHUNK 4
+
+/** \brief character classes 0 to 5 are the vowels 'a','e','i','o','u','y' (index of nWordsWithVowel) */
+#define CHAR_CLASS_A 0
+#define CHAR_CLASS_E 1
+#define CHAR_CLASS_I 2
+#define CHAR_CLASS_O 3
+#define CHAR_CLASS_U 4
+#define CHAR_CLASS_Y 5
+
+/** \brief character class of separation, whitespace and punctuation characters (end a word) */
+#define CHAR_CLASS_SEPARATOR 6
+
+/** \brief character class of apostrophes, which are punctuation but do not end a word */
+#define CHAR_CLASS_APOSTROPHE 7
+
+/** \brief character class of any other character (consonant, digit, ...) */
+#define CHAR_CLASS_OTHER 8
+
+/** \brief identifiers of the processChunk() kernels (-k option) */
+#define KERNEL_AUTO 0
+#define KERNEL_SCALAR 1
+#define KERNEL_SSE2 2
+#define KERNEL_AVX2 3
+
+/** \brief compression formats of the input files (recognised by their magic bytes) */
+#define COMPRESSION_NONE 0
+#define COMPRESSION_GZIP 1
+#define COMPRESSION_ZSTD 2
+
+/** \brief bytes decompressed at a time by the decompression stage of a compressed file */
+#define DECOMPRESS_BUFFER_SIZE (256 * 1024)
+
+/** \brief capacity of the pipe between the decompression stage and the dispatcher (bytes decompressed ahead) */
+#define DECOMPRESS_PIPE_SIZE (1024 * 1024)
+
+/** \brief code point returned by the decoder for invalid UTF-8 sequences */
+#define UTF8_REPLACEMENT_CHAR 0xFFFD
+
+
+/** \brief phases of the spans recorded with --trace (the names are in trace.c) */
+#define TRACE_READ 0            /* Dispatcher gets (or reads) a chunk, worker reads it with MPI-IO */
+#define TRACE_SEND 1            /* Dispatcher sends a chunk */
+#define TRACE_WAIT 2            /* Dispatcher waits for results, worker waits for a chunk */
+#define TRACE_MERGE 3           /* Dispatcher merges the results of a chunk */
+#define TRACE_PROCESS 4         /* Worker processes a batch of chunks */
+#define TRACE_SEND_RESULTS 5    /* Worker sends the results of a chunk */
+#define TRACE_NUM_PHASES 6
 
 #endif /* CONSTANTS_H */
\ No newline at end of file
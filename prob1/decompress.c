@@ -0,0 +1,234 @@
+/**
+ * @file decompress.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Decompression stage of the compressed input files (gzip and zstd)
+ *
+ * A compressed file is recognised by its magic bytes and read as a stream: a decompression stage writes the
+ * decompressed bytes into a pipe, and the dispatcher reads them into its chunk buffers (getChunk()), so the
+ * decompression runs at the same time as the chunks are sent and the workers get decompressed chunks. Only the
+ * compressed bytes are read from the disk, and nothing is decompressed to the disk.
+ *
+ * gzip is decompressed by a thread of the dispatcher with zlib (the thread doesn't call MPI), and zstd by a zstd
+ * process (the zstd library isn't always installed with its headers, the zstd tool usually is).
+ *
+ */
+
+/* pipe2() and F_SETPIPE_SZ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "decompress.h"
+
+/* Environment, given to the zstd processes */
+extern char **environ;
+
+/**
+ * @brief Decompression stage of a file
+ *
+ */
+struct decompressor {
+    char *filename;
+    int compression;
+    int inputFd;                /* Compressed file (gzip) */
+    int outputFd;               /* Write end of the pipe (closed by the stage when the file was decompressed) */
+    pthread_t thread;           /* Thread of a gzip file */
+    pid_t pid;                  /* Process of a zstd file */
+    bool isFailed;
+};
+
+/* Decompression stages that were started */
+static struct decompressor **stages = NULL;
+static int numStages = 0;
+
+
+/**
+ * @brief Get the compression format of a file, from its magic bytes
+ *
+ * @param filename path of the file
+ * @return COMPRESSION_GZIP, COMPRESSION_ZSTD or COMPRESSION_NONE (also if the file can't be read)
+ */
+int getCompression(const char *filename) {
+
+    unsigned char magic[4];
+    int fd = open(filename, O_RDONLY);
+    ssize_t bytesRead = (fd < 0) ? 0 : pread(fd, magic, sizeof(magic), 0);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (bytesRead >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+        return COMPRESSION_GZIP;
+    }
+    if (bytesRead == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) {
+        return COMPRESSION_ZSTD;
+    }
+
+    return COMPRESSION_NONE;
+
+}
+
+
+/**
+ * @brief Thread of the decompression stage of a gzip file: decompresses it into the pipe (gzread() goes on
+ * through the members of a multi-member file)
+ *
+ * @param arg decompressor structure of the file
+ * @return NULL
+ */
+static void *decompressGzip(void *arg) {
+
+    struct decompressor *stage = (struct decompressor *) arg;
+    unsigned char *buffer = (unsigned char *) malloc(DECOMPRESS_BUFFER_SIZE);
+    gzFile input = gzdopen(stage->inputFd, "rb");
+    int bytesRead = 0;
+
+    if (input != NULL) {
+        gzbuffer(input, DECOMPRESS_BUFFER_SIZE);
+        while ((bytesRead = gzread(input, buffer, DECOMPRESS_BUFFER_SIZE)) > 0) {
+            for (int done = 0; done < bytesRead; ) {
+                ssize_t bytesWritten = write(stage->outputFd, buffer + done, bytesRead - done);
+                if (bytesWritten < 0 && errno != EINTR) {
+                    bytesRead = -1;
+                    break;
+                }
+                done += (bytesWritten > 0) ? bytesWritten : 0;
+            }
+            if (bytesRead < 0) {
+                break;
+            }
+        }
+        /* A truncated file ends without an error of gzread(), but gzerror() has it */
+        int error = Z_OK;
+        gzerror(input, &error);
+        stage->isFailed = (bytesRead < 0 || (error != Z_OK && error != Z_STREAM_END));
+        gzclose(input);
+    } else {
+        stage->isFailed = true;
+        close(stage->inputFd);
+    }
+
+    /* The end of the pipe is the end of the stream */
+    close(stage->outputFd);
+    free(buffer);
+
+    return NULL;
+
+}
+
+
+/**
+ * @brief Starts the decompression stage of a compressed file, which writes the decompressed bytes into a pipe while
+ * the chunks are sent: a thread (zlib) for gzip, including multi-member files like bgzip, and a zstd process for zstd
+ *
+ * @param file fileInfo structure of the compressed file
+ * @return read end of the pipe (the file is read as a stream)
+ */
+int openDecompressor(struct fileInfo *file) {
+
+    struct decompressor *stage = (struct decompressor *) calloc(1, sizeof(struct decompressor));
+    int fds[2];
+
+    stage->filename = file->filename;
+    stage->compression = file->compression;
+    stage->pid = -1;
+
+    /* The pipe keeps DECOMPRESS_PIPE_SIZE bytes decompressed ahead of the dispatcher (if the system allows it) */
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        printf("[ERROR] Can't create the pipe of the decompression of %s\n", file->filename);
+        exit(1);
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, DECOMPRESS_PIPE_SIZE);
+    stage->outputFd = fds[1];
+
+    /* The dispatcher must not be killed if a stage writes into a closed pipe */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (file->compression == COMPRESSION_GZIP) {
+
+        stage->inputFd = open(file->filename, O_RDONLY | O_CLOEXEC);
+        if (stage->inputFd < 0) {
+            printf("[ERROR] Can't open file %s\n", file->filename);
+            exit(1);
+        }
+        if (pthread_create(&stage->thread, NULL, decompressGzip, stage) != 0) {
+            printf("[ERROR] Can't create the decompression thread of %s\n", file->filename);
+            exit(1);
+        }
+
+    } else {
+
+        /* zstd writes the decompressed file into the pipe (the file descriptors of the pipe are closed on exec) */
+        char *argv[] = { "zstd", "-dcq", "--", file->filename, NULL };
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, stage->outputFd, STDOUT_FILENO);
+        if (posix_spawnp(&stage->pid, "zstd", &actions, NULL, argv, environ) != 0) {
+            printf("[ERROR] Can't run zstd to decompress %s\n", file->filename);
+            exit(1);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        close(stage->outputFd);
+
+    }
+
+    stages = (struct decompressor **) realloc(stages, (numStages + 1) * sizeof(struct decompressor *));
+    stages[numStages++] = stage;
+
+    return fds[0];
+
+}
+
+
+/**
+ * @brief Waits for the decompression stages that were started (the whole files were read), and exits if
+ * one of them failed, since the results of its file would be wrong
+ *
+ */
+void waitDecompressors() {
+
+    bool isFailed = false;
+
+    for (int i = 0; i < numStages; i++) {
+
+        struct decompressor *stage = stages[i];
+        if (stage->compression == COMPRESSION_GZIP) {
+            pthread_join(stage->thread, NULL);
+        } else {
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(stage->pid, &status, 0)) < 0 && errno == EINTR);
+            stage->isFailed = (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+        }
+
+        if (stage->isFailed) {
+            printf("[ERROR] Can't decompress %s (invalid or truncated)\n", stage->filename);
+            isFailed = true;
+        }
+        free(stage);
+
+    }
+
+    free(stages);
+    stages = NULL;
+    numStages = 0;
+
+    if (isFailed) {
+        exit(1);
+    }
+
+}
@@ -0,0 +1,37 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the decompression stage of the compressed input files (gzip and zstd).
+ *
+ */
+
+#include "utils.h"
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+/**
+ * @brief Get the compression format of a file, from its magic bytes
+ *
+ * @param filename path of the file
+ * @return COMPRESSION_GZIP, COMPRESSION_ZSTD or COMPRESSION_NONE (also if the file can't be read)
+ */
+extern int getCompression(const char *filename);
+
+/**
+ * @brief Starts the decompression stage of a compressed file, which writes the decompressed bytes into a pipe while
+ * the chunks are sent: a thread (zlib) for gzip, including multi-member files like bgzip, and a zstd process for zstd
+ *
+ * @param file fileInfo structure of the compressed file
+ * @return read end of the pipe (the file is read as a stream)
+ */
+extern int openDecompressor(struct fileInfo *file);
+
+/**
+ * @brief Waits for the decompression stages that were started (the whole files were read), and exits if
+ * one of them failed, since the results of its file would be wrong
+ *
+ */
+extern void waitDecompressors();
+
+#endif /* DECOMPRESS_H */
@@ -9,49 +9,80 @@
  * and the size of the chunk in bytes (optional) and process them in order to:
  * - get the number of words in the file;
  * - get the number of words with each vowel (['a','e','i','o','u','y']) in the file;
+ * - with --metrics, get the letter frequencies, the word lengths, the occurrences of each vowel and the number of
+ *   sentences of the file, in the same pass over the bytes;
  * 
  * This program uses a multiprocess solution, using the MPI library, where the dispatcher (root process) will
- * read the chunk from the input files and send it to available worker processes (different from the root process).
+ * read the chunk from the input files and send it to the worker processes (different from the root process) that
+ * ask for work, so that a slow worker doesn't stall the others.
  * 
  * The workers should process the chunk to extract the information (numWords and nWordsWithVowel) and then send the
  * partial results to the dispatcher, which will save all the partial results from the workers in order to get the
- * total numWords and nWordsWithVowel of each file.
+ * total numWords and nWordsWithVowel of each file. The chunks are fixed-size ranges of bytes (which may cut a word or
+ * a character), so the partial results are summaries that the dispatcher merges in the order of the chunks.
+ *
+ * On several nodes the dispatch has two levels: the first rank of each node without the dispatcher is a node
+ * dispatcher, which asks the dispatcher for super-chunks (a chunk for each worker of its node), splits them among the
+ * workers of its node the same way, and sends the merged summary of each super-chunk back to the dispatcher.
  *
  * Dispatcher process workflow:
  *
  * 1 - Read and process the command line arguments;
  * 2 - Store filenames and initialize the structure related each file
  * 3 - Broadcast a message with the limit of bytes each chunk will have
- * 4 - While there's work to do / files to process (workStatus == 0):
- *      4.1 - Get a chunk with CHUNK_BYTE_LIMIT bytes of the current file we're analyzing
- *      4.2 - Send the chunk (and other important info) to the worker process for processing
- *      4.3 - Receive the partial results from the worker's processed chunk
- *      4.4 - Add the chunk results to the file results
- * 5 - Inform workers that all files are process and they can exit
+ * 4 - While there are workers that weren't told to exit:
+ *      4.1 - Receive a message from any worker (MPI_ANY_SOURCE): a chunk request or the partial results of its last chunk
+ *      4.2 - Merge the chunk results (if any) into the file results, in the order of the chunks (only the ends of the
+ *            chunk, the words inside it are counted by the worker and reduced at the end)
+ *      4.3 - Get a chunk of the current (memory mapped) file we're analyzing, with the chunk size set by -c
+ *            (or, with -c auto, tuned with the processing and waiting times measured by the workers)
+ *      4.4 - Send the chunk (and other important info) to that worker, or inform it that all files are processed and it can exit
+ *            (with -i only the byte range of the chunk is sent, the worker reads it from the file with MPI-IO, and
+ *            a worker on the same node gets the chunk in its buffer of a shared memory window and only the header is sent)
+ * 5 - Sum the counters of the words inside the chunks of all the workers into the file results (a reduction per node, then one of the nodes)
  * 6 - Print the results of the text processing of all the input files
+ *      (with --top, the word counts of all the ranks are merged first and the most frequent words are reduced)
  * 7 - Finalize
  * 
  * Worker process workflow:
  *
  * 1 - Receive the broadcasted message from the dispatcher with the limit of bytes each chunk will have
- * 2 - While the dispatcher says there's work to be done (while workStatus == 0):
- *      2.1 - Receive the chunk and other important info from the dispatcher
- *      2.2 - Process the received chunk
- *      2.3 - Send the partial results from chunk processing to the dispatcher process
- * 3 - Finalize
+ * 2 - Request the first chunk from the dispatcher (or from the node dispatcher of its node)
+ * 3 - Until the dispatcher says all files are processed (end of work message):
+ *      3.1 - Receive the chunk and other important info from the dispatcher
+ *      3.2 - Process the received chunk (and the ones received after it) with the threads of the worker
+ *            (with --top, its words are counted too, except the ones cut by its ends, which are sent to the dispatcher)
+ *      3.3 - Add the words inside the chunk to the counters of its file, and send the rest of the partial results (the
+ *            ends of the chunk) to the dispatcher process (which requests the next chunk)
+ * 4 - Sum the counters of all the workers into the results of the dispatcher (a reduction per node, then one of the nodes)
+ * 5 - With --top, merge the word counts with the other ranks
+ * 6 - Finalize
  *
  */
 
+#include <getopt.h>
+#include <inttypes.h>
 #include <mpi.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "constants.h"
 #include "utils.h"
+#include "simd.h"
+#include "threads.h"
+#include "pool.h"
+#include "tuner.h"
+#include "trace.h"
+#include "words.h"
+#include "classes.h"
+#include "cache.h"
+#include "metrics.h"
 
 /* Number of files to be processed */
 int numFiles = 0;
@@ -59,21 +90,120 @@ int numFiles = 0;
 /* Max. number of bytes allowed for a chunk */
 int CHUNK_BYTE_LIMIT;
 
-/* Stores the index of the current file being proccessed by the working processes */
+/* Number of threads of each worker */
+int numThreads = 1;
+
+/* Stores the position (in the schedule of the files) of the current file being proccessed by the working processes */
 int currentFileIndex = 0;
 
+/* Kernel used by the workers to process the chunks (KERNEL_AUTO picks the best one supported by the CPU) */
+int kernel = KERNEL_AUTO;
+
+/* Number of chunks that can be in flight (sent and not processed yet) per worker */
+int pipelineDepth = 2;
+
+/* Tells if the workers read their chunks from the files themselves (the dispatcher only sends byte ranges) */
+bool parallelIO = false;
+
+/* Tells if some input is a stream (stdin, pipe or FIFO), whose chunks are read into the buffers of the dispatcher */
+bool streamInput = false;
+
+/* Number of most frequent words printed per file (0 if the words aren't counted) */
+int topK = 0;
+
+/* Metrics counted in the same pass as the words (--metrics, 0 if there are none) */
+int metricsMask = 0;
+
+/* Tells if the workers keep the counters of the words inside their chunks, which are reduced at the end (false if there are running totals) */
+bool reduceCounters = true;
+
+/* Tells if the workers on the node of the dispatcher get their chunks through a shared memory window (--no-shared disables it) */
+bool sharedMemory = true;
+
+/* Shared memory window with the chunk buffers of the workers on the node of the dispatcher (MPI_WIN_NULL if there are none) */
+MPI_Win chunkWindow = MPI_WIN_NULL;
+
+/* Chunk buffers of each rank in the shared memory window (their memory is NULL if the rank isn't on the node of the dispatcher) */
+struct bufferPool *sharedPools = NULL;
+
+/* Ranks per node dispatcher (--node-ranks): the ranks of each node are split into groups of nodeRanks ranks (0 for the whole node) */
+int nodeRanks = 0;
+
+/* Ranks of the node (or group of ranks) of this rank, which share memory. Its first rank is rank 0 or the node dispatcher */
+MPI_Comm nodeComm = MPI_COMM_NULL;
+
+/* First rank of each node (rank 0, the node dispatchers and the ranks alone on their nodes), which reduce the counters of their nodes */
+MPI_Comm leaderComm = MPI_COMM_NULL;
+
+/* Communicator of a worker with its dispatcher, which is its rank 0 (nodeComm for the workers of a node dispatcher) */
+MPI_Comm dispatchComm = MPI_COMM_WORLD;
+
+/* Tells if this rank is a node dispatcher: it gets super-chunks from rank 0 and splits them among the workers of its node */
+bool isNodeDispatcher = false;
+
+/* Number of chunks in the messages of rank 0 to each rank: 1 for a worker, the super-chunks of a node dispatcher, 0 if rank 0 doesn't serve it (rank 0 only) */
+int *messageChunks = NULL;
+
+/* Number of node dispatchers (rank 0 only) */
+int numNodeDispatchers = 0;
+
+/* Number of workers of this node dispatcher (each super-chunk is split into at most one slice per worker) */
+int nodeWorkers = 0;
+
+/* Number of chunks of the super-chunks of this node dispatcher: one per worker, in at most MAX_SUPER_CHUNK_SIZE bytes */
+int superChunkChunks = 0;
+
+/* Super-chunks of this node dispatcher, one per buffer of the super-chunks in flight (pipelineDepth) */
+struct superChunk *superChunks = NULL;
+
 /* File structure declaration - will be used to store file related data (numWords, etc..) */
 extern struct fileInfo *files;
 
-/** Process control variable - used to know if there's still work to be done (or not) 
- * 0 -> Work is not done yet. There are still chunks/files that need to be read and/or processed
- * (!= 0) -> If workStatus = N, then process N received the last chunk and needs to process it, while others processes dont ask for another job/chunk
- */
-int workStatus = 0;
-
 /* Declaration of the function usage -> Usage of the program */
 void usage();
 
+/* Declaration of the function sendChunks -> Dispatcher sends chunks to a worker until its pipeline is full */
+bool sendChunks(int worker, MPI_Comm comm, struct bufferPool *pools, MPI_Request *requests, struct chunkTuner *tuner);
+
+/* Declaration of the function splitNodes -> Ranks are split by node, with a node dispatcher on the nodes without rank 0 */
+void splitNodes(int rank, int size);
+
+/* Declaration of the function dispatchNode -> Node dispatcher splits the super-chunks of rank 0 among the workers of its node */
+void dispatchNode(int rank, int size, MPI_Datatype resultsType);
+
+/* Declaration of the function getSlice -> Node dispatcher gets the next slice of its super-chunks */
+unsigned int getSlice(struct fileChunk *chunkData);
+
+/* Declaration of the function createResultsType -> Derived datatype of the chunkResults structure */
+MPI_Datatype createResultsType(bool withMetrics);
+
+/* Declaration of the function getNumFileCounters -> Number of counters of each file reduced at the end */
+int getNumFileCounters();
+
+/* Declaration of the function takeFileCounters -> Moves the additive counts of a summary into the counters of its file */
+void takeFileCounters(uint64_t *fileCounters, struct chunkSummary *summary);
+
+/* Declaration of the function broadcastFilenames -> Dispatcher sends the filenames to the workers */
+void broadcastFilenames(int rank, char *filenames[]);
+
+/* Declaration of the function readChunk -> Worker reads the byte range of a chunk with MPI-IO */
+void readChunk(struct chunkHeader *header, MPI_File *handles, unsigned char *buffer, struct fileChunk *chunkData);
+
+/* Declaration of the function broadcastCharClasses -> Dispatcher sends the character classes to the workers */
+void broadcastCharClasses(int rank);
+
+/* Declaration of the function createChunkWindow -> Workers on the node of the dispatcher put their chunk buffers in a shared memory window */
+void createChunkWindow(int size);
+
+/* Declaration of the function freeChunkWindow -> Frees the shared memory window of the chunk buffers */
+void freeChunkWindow();
+
+/* Declaration of the function reduceFileCounters -> The counters of the workers are summed into the results of the files */
+void reduceFileCounters(int rank, uint64_t *counters);
+
+/* Declaration of the function reduceWordCounts -> All ranks merge their word counts and reduce the most frequent words */
+struct wordCount *reduceWordCounts(int rank, int size);
+
 /**
  * @brief Main program
  *
@@ -82,23 +212,33 @@ void usage();
  * 1 - Read and process the command line arguments;
  * 2 - Store filenames and initialize the structure related each file
  * 3 - Broadcast a message with the limit of bytes each chunk will have
- * 4 - While there's work to do / files to process (workStatus == 0):
- *      4.1 - Get a chunk with CHUNK_BYTE_LIMIT bytes of the current file we're analyzing
- *      4.2 - Send the chunk (and other important info) to the worker process for processing
- *      4.3 - Receive the partial results from the worker's processed chunk
- *      4.4 - Add the chunk results to the file results
- * 5 - Inform workers that all files are process and they can exit
+ * 4 - While there are workers that weren't told to exit:
+ *      4.1 - Receive a message from any worker (MPI_ANY_SOURCE): a chunk request or the partial results of its last chunk
+ *      4.2 - Merge the chunk results (if any) into the file results, in the order of the chunks (only the ends of the
+ *            chunk, the words inside it are counted by the worker and reduced at the end)
+ *      4.3 - Get a chunk of the current (memory mapped) file we're analyzing, with the chunk size set by -c
+ *            (or, with -c auto, tuned with the processing and waiting times measured by the workers)
+ *      4.4 - Send the chunk (and other important info) to that worker, or inform it that all files are processed and it can exit
+ *            (with -i only the byte range of the chunk is sent, the worker reads it from the file with MPI-IO, and
+ *            a worker on the same node gets the chunk in its buffer of a shared memory window and only the header is sent)
+ * 5 - Sum the counters of the words inside the chunks of all the workers into the file results (a reduction per node, then one of the nodes)
  * 6 - Print the results of the text processing of all the input files
+ *      (with --top, the word counts of all the ranks are merged first and the most frequent words are reduced)
  * 7 - Finalize
  * 
  * Worker process workflow:
  *
  * 1 - Receive the broadcasted message from the dispatcher with the limit of bytes each chunk will have
- * 2 - While the dispatcher says there's work to be done (while workStatus == 0):
- *      2.1 - Receive the chunk and other important info from the dispatcher
- *      2.2 - Process the received chunk
- *      2.3 - Send the partial results from chunk processing to the dispatcher process
- * 3 - Finalize
+ * 2 - Request the first chunk from the dispatcher (or from the node dispatcher of its node)
+ * 3 - Until the dispatcher says all files are processed (end of work message):
+ *      3.1 - Receive the chunk and other important info from the dispatcher
+ *      3.2 - Process the received chunk (and the ones received after it) with the threads of the worker
+ *            (with --top, its words are counted too, except the ones cut by its ends, which are sent to the dispatcher)
+ *      3.3 - Add the words inside the chunk to the counters of its file, and send the rest of the partial results (the
+ *            ends of the chunk) to the dispatcher process (which requests the next chunk)
+ * 4 - Sum the counters of all the workers into the results of the dispatcher (a reduction per node, then one of the nodes)
+ * 5 - With --top, merge the word counts with the other ranks
+ * 6 - Finalize
  *
  *
  * @param argc
@@ -109,18 +249,19 @@ int main(int argc, char *argv[]) {
 
     /* Initialize MPI variables */
     int rank, size;     /* Rank - Process ID | Size - Number of processes (including root)*/
-    unsigned int numWords = 0;          /* Variable used to store the number of words of a worker's processed chunk */
-    unsigned int nWordsWithVowel[6];    /* Variable used to store the number of words with vowels [aeiouy] of a worker's processed chunk */
-    unsigned int fileIndex;             /* Variable used to store the file index of a worker's processed chunk */
+    int provided;       /* Thread support provided by the MPI library */
+    struct chunkResults results;        /* Partial results of a worker's processed chunk */
+    MPI_Datatype resultsType;           /* Derived datatype that describes the chunkResults structure */
     
     /* Initialize the MPI communicator and get the rank of processes and the count of processes */
-    MPI_Init(&argc, &argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    memset(&results, 0, sizeof(struct chunkResults));
 
-    /* ERROR. Number of processes should be limited. */
-    if (size < 2 || size > 9) {
-        fprintf(stderr, "Invalid number of processes (must be >= 2 and <= 9)");
+    /* ERROR. There must be a dispatcher and at least one worker. */
+    if (size < 2) {
+        fprintf(stderr, "Invalid number of processes (must be >= 2)");
         return EXIT_FAILURE;
     }
 
@@ -131,10 +272,31 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    const char *optstr = "f:c:h";           /* Acceptable command line arguments and parsing */
+    const char *optstr = "f:t:c:k:d:ih";     /* Acceptable command line arguments and parsing */
+    const struct option longOptions[] = {    /* Long options (--stdin is the same as -f -) */
+        { "stdin", no_argument, NULL, 's' },
+        { "interval", required_argument, NULL, 'r' },
+        { "stats", no_argument, NULL, 'S' },
+        { "trace", required_argument, NULL, 'T' },
+        { "top", required_argument, NULL, 'K' },
+        { "classes", required_argument, NULL, 'C' },
+        { "no-shared", no_argument, NULL, 'N' },
+        { "cache", required_argument, NULL, 'R' },
+        { "node-ranks", required_argument, NULL, 'G' },
+        { "metrics", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 }
+    };
+    double totalsInterval = RUNNING_TOTALS_INTERVAL;    /* Seconds between the running totals of the streams */
+    bool printStats = false;                /* Tells if the throughput statistics are printed (--stats) */
+    char *traceFile = NULL;                 /* Trace file of the timeline of the ranks (--trace) */
+    bool traceEnabled = false;              /* Tells if the ranks record their timeline */
+    char *classesFile = NULL;               /* Spec file of the character classes (--classes, by default Portuguese) */
+    char *cacheFile = NULL;                 /* Cache of the results of the files (--cache) */
     int option;                             /* Store current command line arg */
-    char *filenames[MAX_NUM_FILES];         /* Declare filenames array */
-    CHUNK_BYTE_LIMIT = 4096;                /* Default chunk limit (in bytes) */
+    char **filenames = NULL;                /* Declare filenames array (there are at most argc files) */
+    CHUNK_BYTE_LIMIT = DEFAULT_CHUNK_SIZE;  /* Default chunk limit (in bytes) */
+    bool autoChunkSize = false;             /* Tells if the chunk size is tuned by the dispatcher (-c auto) */
+    bool depthIsSet = false;                /* Tells if the pipeline depth was set in the command line */
 
     if (rank == 0) {
 
@@ -154,14 +316,16 @@ int main(int argc, char *argv[]) {
         * - present the final results
         */
 
+        filenames = (char **) malloc(argc * sizeof(char *));
+
         /* Process command line arguments */
-        while ((option = getopt(argc, argv, optstr)) != -1) {
+        while ((option = getopt_long(argc, argv, optstr, longOptions, NULL)) != -1) {
             switch (option) {
                 case 'f':
-                    /* Save input files names*/
+                    /* Save input files names (- is stdin) */
                     filenames[numFiles++] = optarg;
-                    while (optind < argc && argv[optind][0] != '-') {
-                        if (access(argv[optind], F_OK) == 0) {
+                    while (optind < argc && (argv[optind][0] != '-' || strcmp(argv[optind], "-") == 0)) {
+                        if (strcmp(argv[optind], "-") == 0 || access(argv[optind], F_OK) == 0) {
                             // file exists
                             filenames[numFiles++] = argv[optind];
                         } else {
@@ -173,12 +337,101 @@ int main(int argc, char *argv[]) {
                     }
                     break;
                 case 'c':
-                    /* Define chunk size */
-                    if (atoi(optarg) != 4096 && atoi(optarg) != 8192) {
-                        fprintf(stderr, "Invalid chunk size (must be 4k or 8k)");
-                        return EXIT_FAILURE;
+                    /* Define chunk size (with auto, CHUNK_BYTE_LIMIT is the largest chunk size) */
+                    CHUNK_BYTE_LIMIT = parseChunkSize(optarg, &autoChunkSize);
+                    if (CHUNK_BYTE_LIMIT < 0) {
+                        fprintf(stderr, "Invalid chunk size (must be auto or %d to %d bytes, e.g. 64k or 4M)\n", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    if (autoChunkSize) {
+                        CHUNK_BYTE_LIMIT = AUTO_MAX_CHUNK_SIZE;
+                    }
+                    break;
+                case 'k':
+                    /* Define the kernel used to process the chunks */
+                    kernel = parseKernelName(optarg);
+                    if (kernel < 0) {
+                        fprintf(stderr, "Invalid kernel (must be auto, scalar, sse2 or avx2)\n");
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    break;
+                case 'd':
+                    /* Define the number of chunks in flight per worker */
+                    pipelineDepth = atoi(optarg);
+                    if (pipelineDepth < 1 || pipelineDepth > MAX_PIPELINE_DEPTH) {
+                        fprintf(stderr, "Invalid pipeline depth (must be >= 1 and <= %d)\n", MAX_PIPELINE_DEPTH);
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    depthIsSet = true;
+                    break;
+                case 't':
+                    /* Define the number of threads of each worker */
+                    numThreads = atoi(optarg);
+                    if (numThreads < 1 || numThreads > MAX_NUM_THREADS) {
+                        fprintf(stderr, "Invalid number of threads (must be >= 1 and <= %d)\n", MAX_NUM_THREADS);
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    break;
+                case 'i':
+                    /* The workers read their chunks from the files themselves */
+                    parallelIO = true;
+                    break;
+                case 's':
+                    /* Read stdin (streaming) */
+                    filenames[numFiles++] = "-";
+                    break;
+                case 'r':
+                    /* Define the interval of the running totals of the streams (0 disables them) */
+                    totalsInterval = atof(optarg);
+                    if (totalsInterval < 0) {
+                        fprintf(stderr, "Invalid interval (must be >= 0 seconds)\n");
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    break;
+                case 'S':
+                    /* Print the throughput statistics (used by the benchmarks) */
+                    printStats = true;
+                    break;
+                case 'T':
+                    /* Record the timeline of each rank into a trace file */
+                    traceFile = optarg;
+                    traceEnabled = true;
+                    break;
+                case 'C':
+                    /* Load the character classes (vowels, separators and apostrophes) from a spec file */
+                    classesFile = optarg;
+                    break;
+                case 'R':
+                    /* Keep the results of the files in a cache, to skip the files (or the bytes) that were already processed */
+                    cacheFile = optarg;
+                    break;
+                case 'G':
+                    /* Split the ranks of each node into groups of this size, each with its own node dispatcher */
+                    nodeRanks = atoi(optarg);
+                    if (nodeRanks < 2) {
+                        fprintf(stderr, "Invalid number of ranks per node dispatcher (must be >= 2)\n");
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    break;
+                case 'N':
+                    /* The workers on the node of the dispatcher get their chunks in messages too */
+                    sharedMemory = false;
+                    break;
+                case 'M':
+                    /* Count the metrics (letters, word lengths, vowels and sentences) in the same pass as the words */
+                    metricsMask = parseMetrics(optarg);
+                    if (metricsMask < 0) {
+                        fprintf(stderr, "Invalid metrics (must be letters, lengths, vowels, sentences or all, separated by commas)\n");
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                    }
+                    break;
+                case 'K':
+                    /* Count the words and print the most frequent ones of each file */
+                    topK = atoi(optarg);
+                    if (topK < 1 || topK > MAX_TOP_WORDS) {
+                        fprintf(stderr, "Invalid number of words (must be >= 1 and <= %d)\n", MAX_TOP_WORDS);
+                        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
                     }
-                    CHUNK_BYTE_LIMIT = atoi(optarg);
                     break;
                 case 'h':
                     /* Program usage */
@@ -190,71 +443,232 @@ int main(int argc, char *argv[]) {
             }
         }        
 
+        /* ERROR. The cache only has the number of words of the files, not the words themselves. */
+        if (cacheFile != NULL && topK > 0) {
+            fprintf(stderr, "The cache (--cache) only has the number of words of the files, it can't be used with --top\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
+        /**
+         * ERROR. The threads of the workers need (at least) funneled thread support. Without it, the workers still
+         * run with a single thread (-t 1, the default)
+         */
+        if (numThreads > 1 && provided < MPI_THREAD_FUNNELED) {
+            fprintf(stderr, "The MPI library doesn't support threads (MPI_THREAD_FUNNELED), -t must be 1\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
+        /* Compile the character classes, which are sent to the workers with the other options (loadCharClasses() prints the error) */
+        if (loadCharClasses(classesFile) != 0) {
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
+        /**
+         * By default, keep enough chunks in flight for every thread of a worker to have one (and the next ones), as long
+         * as their buffers fit in the memory of a worker
+         */
+        size_t bufferBytes = CHUNK_HEADER_SPACE + (size_t) CHUNK_BYTE_LIMIT;
+        if (!depthIsSet && numThreads > 1) {
+            pipelineDepth = (2 * numThreads < MAX_PIPELINE_DEPTH) ? 2 * numThreads : MAX_PIPELINE_DEPTH;
+            if (pipelineDepth * bufferBytes > MAX_WORKER_BUFFER_BYTES) {
+                pipelineDepth = (MAX_WORKER_BUFFER_BYTES / bufferBytes > 1) ? MAX_WORKER_BUFFER_BYTES / bufferBytes : 1;
+            }
+        }
+
+        /* ERROR. The chunk buffers of a worker (allocated once) can't take more than MAX_WORKER_BUFFER_BYTES. */
+        if (pipelineDepth * bufferBytes > MAX_WORKER_BUFFER_BYTES) {
+            fprintf(stderr, "Invalid pipeline depth and chunk size (%d buffers of %zu bytes, the chunk buffers of a worker must take at most %d MiB)\n",
+                    pipelineDepth, bufferBytes, MAX_WORKER_BUFFER_BYTES / (1024 * 1024));
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
         /* Allocation of memory to the fileInfo structure */
         files = (struct fileInfo *)malloc(numFiles * sizeof(struct fileInfo));
         /* Initialize fileInfo structure (setup and store filenames) */
         storeFilenames(files, filenames);
 
-        /* Keep track of the current worker's rank ID */
-        int nWorkers = 0;
+        /**
+         * Size of the chunks (the tuning needs the size of the whole input, which is unknown if there are streams).
+         * Compressed files are streams too: their decompressed bytes are read through a pipe
+         */
+        struct chunkTuner tuner;
+        size_t totalBytes = 0;
+        for (int i = 0; i < numFiles; i++) {
+            struct stat fileStat;
+            if (strcmp(filenames[i], "-") == 0 || (files + i)->compression != COMPRESSION_NONE ||
+                (stat(filenames[i], &fileStat) == 0 && !S_ISREG(fileStat.st_mode))) {
+                streamInput = true;
+            } else if (stat(filenames[i], &fileStat) == 0) {
+                totalBytes += fileStat.st_size;
+            }
+        }
+        if (streamInput && parallelIO) {
+            fprintf(stderr, "Streams (stdin, pipes, FIFOs and compressed files) can't be read by the workers (-i)\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
+        /* Workers that read their chunks themselves only get the headers, there's nothing to share */
+        sharedMemory = sharedMemory && !parallelIO;
+
+        /* The running totals of the streams need all the counts of the chunks merged so far */
+        reduceCounters = !(streamInput && totalsInterval > 0);
+
+        /* The files (or the old bytes of the files that grew) whose results are in the cache aren't processed */
+        uint64_t cachedBytes = 0;
+        if (cacheFile != NULL) {
+            loadResultCache(cacheFile);
+            cachedBytes = applyResultCache();
+            totalBytes -= cachedBytes;
+        }
+
+        /* The files are read from the largest to the smallest, so the last chunks are small files */
+        scheduleFiles();
+
+        /* Time of the last running totals */
+        struct timespec lastTotals = start;
+
+        /* Status of the last message received from a worker (used to know its rank and tag) */
+        MPI_Status status;
 
 		/* Broadcast message to working processes, so that they can start asking for chunks */
 		MPI_Bcast(&CHUNK_BYTE_LIMIT, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&kernel, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&pipelineDepth, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&numThreads, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&parallelIO, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&sharedMemory, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&reduceCounters, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&traceEnabled, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&nodeRanks, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&topK, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&metricsMask, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&numFiles, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		broadcastCharClasses(rank);
+		if (parallelIO) {
+			broadcastFilenames(rank, filenames);
+		}
+		initTrace(traceEnabled);
+		resultsType = createResultsType(metricsMask != 0 && !reduceCounters);
+		splitNodes(rank, size);
+		if (sharedMemory) {
+			createChunkWindow(size);
+		}
+
+        /**
+         * Number of workers that didn't receive the end of work message yet: the ranks served by rank 0, its workers
+         * and the node dispatchers, which get super-chunks (a chunk for each worker of their nodes). The workers of
+         * the node dispatchers don't exchange messages with rank 0
+         */
+        int activeWorkers = 0, maxMessageChunks = 1;
+        for (int i = 1; i < size; i++) {
+            activeWorkers += (messageChunks[i] > 0);
+            maxMessageChunks = (messageChunks[i] > maxMessageChunks) ? messageChunks[i] : maxMessageChunks;
+        }
+        int directWorkers = activeWorkers - numNodeDispatchers;
+
+        /* The chunk size is tuned for the workers (a super-chunk is a chunk for each worker of its node) */
+        int numWorkers = size - 1 - numNodeDispatchers;
+        initChunkTuner(&tuner, autoChunkSize, CHUNK_BYTE_LIMIT, streamInput ? SIZE_MAX : totalBytes, numWorkers);
+
+        /**
+         * Pipeline of each worker: a pool with pipelineDepth buffers for the headers of the chunks in flight (the
+         * chunks point to the memory mapped files) and the requests of their non-blocking sends. With streams, the
+         * chunks are read into the buffers too, after CHUNK_HEADER_SPACE bytes (or into the buffers of the worker,
+         * if they're in the shared memory window)
+         */
+        struct bufferPool *pools = (struct bufferPool *) calloc(size, sizeof(struct bufferPool));
+        MPI_Request *requests = (MPI_Request *) malloc(size * pipelineDepth * sizeof(MPI_Request));
+        int sharedWorkers = 0;
+        for (int i = 1; i < size; i++) {
+            bool isShared = (sharedPools != NULL && sharedPools[i].memory != NULL);
+            if (messageChunks[i] > 0) {
+                createBufferPool(pools + i, pipelineDepth, (streamInput && !isShared) ? CHUNK_HEADER_SPACE + (size_t) messageChunks[i] * CHUNK_BYTE_LIMIT : sizeof(struct chunkHeader));
+            }
+            sharedWorkers += isShared;
+        }
+        for (int i = 0; i < size * pipelineDepth; i++) {
+            requests[i] = MPI_REQUEST_NULL;
+        }
+
+        /* Statistics: bytes and chunks processed, time the workers spent processing and the dispatcher waiting for them */
+        size_t processedBytes = 0;
+        unsigned long processedChunks = 0;
+        double processingTime = 0, receivingTime = 0;
 
-        /* Wait for chunk requests while there are still files to be processed */
-        while (!workStatus)
+        /* Serve the workers that are ready (chunk request or partial results) until all of them were told to exit */
+        while (activeWorkers > 0)
         {
 
-            /* For all the worker processes */
-            for (nWorkers = 1; nWorkers < size; nWorkers++)
-            {
-                /* All files were processed */
-                if (workStatus != 0) {
-                    break;
-                }
+            /**
+             * Receive a message from any worker: the processing results of one of its chunks (which frees a slot
+             * of its pipeline) or its first chunk request (an empty message)
+             */
+            double receiveStart = MPI_Wtime();
+            MPI_Recv(&results, 1, resultsType, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            receivingTime += MPI_Wtime() - receiveStart;
+            traceSpan(TRACE_WAIT, receiveStart, -1);
 
-                /* Allocate memory to support a fileChunk structure */
-                struct fileChunk *chunkData = (struct fileChunk *) malloc(sizeof(struct fileChunk));
+            if (status.MPI_TAG == MPI_TAG_SEND_RESULTS) {
 
-                /*Allocate memory for the chunk */
-                chunkData->chunk = (unsigned char *) malloc(CHUNK_BYTE_LIMIT * sizeof(unsigned char));
-                chunkData->isFinished = false;
-                /* Get chunk data */
-                chunkData->chunkSize = getChunk(chunkData, nWorkers);
+                releaseBuffer(pools + status.MPI_SOURCE);
+                chunkProcessed(&tuner, results.chunkSize, results.processingTime, results.waitingTime);
+                processedBytes += results.chunkSize;
+                processedChunks++;
+                processingTime += results.processingTime;
 
-                /* Send the workStatus, chunk, fileIndex and chunkSize to the worker process */
-                MPI_Send(&workStatus, 1, MPI_INT, nWorkers, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
-                MPI_Send(chunkData->chunk, CHUNK_BYTE_LIMIT, MPI_UNSIGNED_CHAR, nWorkers, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);   /* the chunk buffer */
-                MPI_Send(&chunkData->fileIndex, 1, MPI_UNSIGNED, nWorkers, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);                  /* the index file of the chunk */
-                MPI_Send(&chunkData->chunkSize, 1, MPI_UNSIGNED, nWorkers, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);                  /* the size of the chunk */
+                /* Merge the summary of the processed chunk (in order) into the results of its file */
+                double mergeStart = traceTime();
+                addChunkSummary(results.chunkIndex, &results.summary, &results.fragments);
+                traceSpan(TRACE_MERGE, mergeStart, results.chunkIndex);
 
-                memset(chunkData->chunk, 0, CHUNK_BYTE_LIMIT * sizeof(unsigned char));
+                /* Running totals of the streams */
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+                double sinceTotals = (now.tv_sec - lastTotals.tv_sec) / 1.0 + (now.tv_nsec - lastTotals.tv_nsec) / 1000000000.0;
+                if (streamInput && totalsInterval > 0 && sinceTotals >= totalsInterval) {
+                    printRunningTotals((now.tv_sec - start.tv_sec) / 1.0 + (now.tv_nsec - start.tv_nsec) / 1000000000.0);
+                    lastTotals = now;
+                }
 
-    
             }
 
-            /* For all the worker processes */
-            for (int i = 1; i < nWorkers; i++)
-            {
+            /* Fill the worker's pipeline. If all files were processed and it has no chunks left, inform it that it can exit */
+            if (!sendChunks(status.MPI_SOURCE, MPI_COMM_WORLD, pools, requests, &tuner) && pools[status.MPI_SOURCE].inUse == 0) {
+                MPI_Send(NULL, 0, MPI_BYTE, status.MPI_SOURCE, MPI_TAG_END_WORK, MPI_COMM_WORLD);
+                activeWorkers--;
+            }
 
-                /* Receive the processing results from each worker process */
-                MPI_Recv(&numWords, 1, MPI_UNSIGNED, i, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(&nWordsWithVowel, 6, MPI_UNSIGNED, i, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(&fileIndex, 1, MPI_UNSIGNED, i, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
 
-                /* Update/store partial results from the processed chunk */
-                (files + fileIndex)->numWords += numWords;
-                for (int j = 0; j < 6; j++) {
-                    (files + fileIndex)->nWordsWithVowel[j] += nWordsWithVowel[j];
-                }
+        /* All the chunks were received by the workers */
+        MPI_Waitall(size * pipelineDepth, requests, MPI_STATUSES_IGNORE);
 
+        /* Maximum number of chunks that were in flight to a worker at the same time */
+        int highWaterMark = 0;
+        for (int i = 1; i < size; i++) {
+            if (pools[i].highWaterMark > highWaterMark) {
+                highWaterMark = pools[i].highWaterMark;
             }
+            destroyBufferPool(pools + i);
+        }
+        freeChunkWindow();
+
+        /* Unmap the files after all the chunks were sent */
+        closeFiles();
 
+        /* Words inside the chunks, counted by the workers (the dispatcher only merged the ends of the chunks) */
+        if (reduceCounters) {
+            uint64_t *counters = (uint64_t *) calloc(numFiles * getNumFileCounters(), sizeof(uint64_t));
+            reduceFileCounters(rank, counters);
+            free(counters);
         }
 
-		/* Inform workers that all files are process and they can exit */
-		for (int i = 1; i < size; i++) {
-		    MPI_Send(&workStatus, 1, MPI_INT, i, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
+        /* Most frequent words of each file (the word counts of all the ranks are merged) */
+        struct wordCount *topWords = (topK > 0) ? reduceWordCounts(rank, size) : NULL;
+
+        /* Save the results of the files, for the next runs */
+        if (cacheFile != NULL) {
+            saveResultCache(cacheFile);
         }
 
         /* Clock end */
@@ -262,9 +676,31 @@ int main(int argc, char *argv[]) {
 
 		/* Print the results of the text processing of all files */
 		getResults();
+		if (topK > 0) {
+			printTopWords(topWords, topK);
+			free(topWords);
+		}
 
 		/* Calculate execution time */
-		printf("\eExecution time = %.6f s\n", (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
+		double executionTime = (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+		printf("\eExecution time = %.6f s\n", executionTime);
+
+		/**
+		 * Throughput statistics (key=value pairs, parsed by bench/bench.sh): the dispatcher is busy when it isn't
+		 * waiting for a message, and the workers when they're processing chunks. The chunk buffers in use per worker
+		 * (high-water mark) are out of the pipelineDepth buffers each worker allocates once, and the sizes of the chunks
+		 * are tuned with -c auto. The workers on the node of the dispatcher got their chunks through the shared memory window,
+		 * and the workers of the node dispatchers (--node-ranks) got theirs as slices of super-chunks. The files that were
+		 * (completely or partially) in the cache had their cached bytes skipped
+		 */
+		if (printStats) {
+			printf("STATS bytes=%zu chunks=%lu seconds=%.6f mb_per_s=%.3f chunks_per_s=%.3f dispatcher_busy=%.4f workers_busy=%.4f buffers_hwm=%d buffers=%d chunk_min=%u chunk_max=%u chunk_auto=%d shared_workers=%d direct_workers=%d node_dispatchers=%d node_workers=%d super_chunk_max=%d cached_files=%d cached_bytes=%" PRIu64 "\n",
+				   processedBytes, processedChunks, executionTime, processedBytes / executionTime / 1000000.0,
+				   processedChunks / executionTime, 1.0 - receivingTime / executionTime, processingTime / (numWorkers * executionTime),
+				   highWaterMark, pipelineDepth, tuner.minSent, tuner.maxSent, autoChunkSize,
+				   sharedWorkers, directWorkers, numNodeDispatchers, numWorkers - directWorkers, maxMessageChunks,
+				   (cacheFile != NULL) ? getCachedFiles() : 0, cachedBytes);
+		}
 
     }
     else
@@ -272,68 +708,1057 @@ int main(int argc, char *argv[]) {
 
         /* Receive brodcast message from the dispatcher */
         MPI_Bcast(&CHUNK_BYTE_LIMIT, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&kernel, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&pipelineDepth, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&numThreads, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&parallelIO, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&sharedMemory, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&reduceCounters, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&traceEnabled, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&nodeRanks, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&topK, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&metricsMask, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&numFiles, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        broadcastCharClasses(rank);
+        if (parallelIO) {
+            filenames = (char **) malloc(numFiles * sizeof(char *));
+            broadcastFilenames(rank, filenames);
+        }
+        initTrace(traceEnabled);
+        resultsType = createResultsType(metricsMask != 0 && !reduceCounters);
+        splitNodes(rank, size);
+        if (sharedMemory) {
+            createChunkWindow(size);
+        }
 
-        /* Allocate memory to support a fileChunk structure */
-        struct fileChunk *chunkData = (struct fileChunk *) malloc(sizeof(struct fileChunk));
-        chunkData->fileIndex = currentFileIndex;
-        chunkData->chunk = (unsigned char *) malloc(CHUNK_BYTE_LIMIT * sizeof(unsigned char));
-        chunkData->chunkSize = 0;
-        chunkData->numWords = 0;
-        for (int i = 0; i < 6; i++) {
-            chunkData->nWordsWithVowel[i] = 0;
+        /* A node dispatcher doesn't process chunks, it splits the super-chunks of rank 0 among the workers of its node */
+        if (isNodeDispatcher) {
+            dispatchNode(rank, size, resultsType);
+            writeTrace(traceFile, isNodeDispatcher);
+            MPI_Type_free(&resultsType);
+            MPI_Finalize();
+            exit(EXIT_SUCCESS);
         }
-        chunkData->isFinished = false;
-        
+
+        /* Rank of this worker for its dispatcher (rank 0, or its node dispatcher) */
+        int dispatchRank;
+        MPI_Comm_rank(dispatchComm, &dispatchRank);
+
+        /* Choose the kernel used to process the chunks (the CPU may not support the requested one) */
+        selectChunkKernel(kernel);
+        if (metricsMask != 0) {
+            initMetrics();
+        }
+
+        /* Start the threads that process the chunks with this one (a batch has at most pipelineDepth chunks) */
+        startThreadPool(pipelineDepth);
+        struct fileChunk **batch = (struct fileChunk **) malloc(pipelineDepth * sizeof(struct fileChunk *));
+
+        /**
+         * Pool (ring) of pipelineDepth aligned message buffers (chunkHeader followed by up to CHUNK_BYTE_LIMIT bytes of
+         * the chunk) and the requests of their non-blocking receives, so that the next chunks are received while the
+         * current ones are processed. The header is received at the end of the first CHUNK_HEADER_SPACE bytes of the
+         * buffer, so the chunk of each slot's fileChunk structure (right after its header) is aligned
+         *
+         * With parallelIO only the header is received, and the chunk is read from the file into the rest of the buffer.
+         * On the node of the dispatcher the buffers are in the shared memory window: the dispatcher puts the chunk in
+         * place and only the header is received
+         */
+        int messageSize = sizeof(struct chunkHeader) + CHUNK_BYTE_LIMIT;
+        int headerOffset = CHUNK_HEADER_SPACE - sizeof(struct chunkHeader);
+        struct bufferPool pool;
+        if (sharedPools != NULL && sharedPools[dispatchRank].memory != NULL) {
+            pool = sharedPools[dispatchRank];
+        } else {
+            createBufferPool(&pool, pipelineDepth, CHUNK_HEADER_SPACE + CHUNK_BYTE_LIMIT);
+        }
+        MPI_File *handles = NULL;
+        if (parallelIO) {
+            handles = (MPI_File *) malloc(numFiles * sizeof(MPI_File));
+            for (int i = 0; i < numFiles; i++) {
+                handles[i] = MPI_FILE_NULL;
+            }
+        }
+        struct fileChunk *slots = (struct fileChunk *) malloc(pipelineDepth * sizeof(struct fileChunk));
+        MPI_Request *requests = (MPI_Request *) malloc(pipelineDepth * sizeof(MPI_Request));
+        MPI_Request endRequest;
+        int currentSlot = 0;
+        bool isFirstBatch = true;
+
+        /* Words inside the chunks of each file processed by this worker (words and words with each vowel, and the metrics) */
+        uint64_t *counters = (uint64_t *) calloc(numFiles * getNumFileCounters(), sizeof(uint64_t));
+
+        for (int i = 0; i < pipelineDepth; i++) {
+            int slot = acquireBuffer(&pool);
+            (slots + slot)->chunk = getBuffer(&pool, slot) + CHUNK_HEADER_SPACE;
+            resetChunkData(slots + slot);
+            MPI_Irecv(getBuffer(&pool, slot) + headerOffset, messageSize, MPI_BYTE, 0, MPI_TAG_SEND_CHUNK, dispatchComm, requests + slot);
+        }
+        MPI_Irecv(NULL, 0, MPI_BYTE, 0, MPI_TAG_END_WORK, dispatchComm, &endRequest);
+
+        /* Ask the dispatcher for the first chunks */
+        MPI_Send(NULL, 0, MPI_BYTE, 0, MPI_TAG_CHUNK_REQUEST, dispatchComm);
 
         while (true)
         {
-    
-            /* Receive the control variable from the dispatcher to know if there's work still to be done (or not) */
-            MPI_Recv(&workStatus, 1, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            /* Wait for the next chunk, or the end of work message if all files have been processed */
+            MPI_Request pending[2] = { requests[currentSlot], endRequest };
+            int completed;
+            double waitStart = MPI_Wtime();
+            MPI_Waitany(2, pending, &completed, MPI_STATUS_IGNORE);
+            double waitEnd = MPI_Wtime();
+            traceSpan(TRACE_WAIT, waitStart, -1);
+            requests[currentSlot] = pending[0];
+            endRequest = pending[1];
 
             /* End worker if all files have been processed */
-            if (workStatus != 0 && workStatus != rank) {
+            if (completed == 1) {
                 break;
             }
 
-            /* Receive the chunk and other additional information for later processing from the dispatcher (root 0 process) */
-            MPI_Recv(chunkData->chunk, CHUNK_BYTE_LIMIT, MPI_UNSIGNED_CHAR, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(&chunkData->fileIndex, 1, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(&chunkData->chunkSize, 1, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            /* With several threads, the chunks already received after this one are processed in the same batch */
+            int batchSize = 1;
+            while (numThreads > 1 && batchSize < pipelineDepth) {
+                int received;
+                MPI_Test(requests + (currentSlot + batchSize) % pipelineDepth, &received, MPI_STATUS_IGNORE);
+                if (!received) {
+                    break;
+                }
+                batchSize++;
+            }
 
-            /* Process the received chunk */
-            processChunk(chunkData);
+            /* The chunks written by the dispatcher into the shared memory window are visible after their headers */
+            if (chunkWindow != MPI_WIN_NULL) {
+                MPI_Win_sync(chunkWindow);
+            }
 
-            /* Send the partial results to the dispatcher (root 0 process) */
-            MPI_Send(&chunkData->numWords, 1, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
-            MPI_Send(&chunkData->nWordsWithVowel, 6, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
-            MPI_Send(&chunkData->fileIndex, 1, MPI_UNSIGNED, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
+            size_t batchBytes = 0;
+            for (int i = 0; i < batchSize; i++) {
 
-            /* Reset chunk data */
-            resetChunkData(chunkData);
+                int slot = (currentSlot + i) % pipelineDepth;
+                struct fileChunk *chunkData = slots + slot;
+                unsigned char *message = getBuffer(&pool, slot) + headerOffset;
+
+                /* The chunk itself is already in place, after the header (unless the worker has to read it) */
+                struct chunkHeader *header = (struct chunkHeader *) message;
+                chunkData->fileIndex = header->fileIndex;
+                chunkData->chunkIndex = header->chunkIndex;
+                chunkData->offset = header->offset;
+                chunkData->chunkSize = header->chunkSize;
+                if (parallelIO) {
+                    double readStart = traceTime();
+                    readChunk(header, handles, message + sizeof(struct chunkHeader), chunkData);
+                    traceSpan(TRACE_READ, readStart, chunkData->chunkIndex);
+                }
+                batch[i] = chunkData;
+                batchBytes += chunkData->chunkSize;
+
+            }
+
+            /* Process the received chunks (the span has the index of the first one), and count their words with --top */
+            double processStart = traceTime();
+            processChunks(batch, batchSize);
+            for (int i = 0; topK > 0 && i < batchSize; i++) {
+                countChunkWords(batch[i]);
+            }
+            traceSpan(TRACE_PROCESS, processStart, batch[0]->chunkIndex);
+
+            /* The chunks are done with before their buffers can be written again by the dispatcher */
+            if (chunkWindow != MPI_WIN_NULL) {
+                MPI_Win_sync(chunkWindow);
+            }
+
+            /**
+             * Times reported to the dispatcher (which tunes the chunk size with them): the batch time is split by the
+             * bytes of each chunk and the waiting time evenly. The first wait also covers the startup, so it's ignored
+             */
+            double processingTime = MPI_Wtime() - waitEnd;
+            double waitingTime = isFirstBatch ? 0 : (waitEnd - waitStart) / batchSize;
+            isFirstBatch = false;
+
+            for (int i = 0; i < batchSize; i++) {
+
+                struct fileChunk *chunkData = slots + (currentSlot + i) % pipelineDepth;
+
+                /* Send the partial results to the dispatcher (root 0 process), which frees a slot of the pipeline */
+                results.chunkIndex = chunkData->chunkIndex;
+                results.chunkSize = chunkData->chunkSize;
+                results.processingTime = (batchBytes > 0) ? processingTime * chunkData->chunkSize / batchBytes : 0;
+                results.waitingTime = waitingTime;
+                results.summary = chunkData->summary;
+                results.fragments = chunkData->fragments;
+
+                /* The counts are additive, so only the ends of the chunk (the rest of its summary) are merged in order */
+                if (reduceCounters) {
+                    takeFileCounters(counters + chunkData->fileIndex * getNumFileCounters(), &results.summary);
+                }
+                double sendStart = traceTime();
+                MPI_Send(&results, 1, resultsType, 0, MPI_TAG_SEND_RESULTS, dispatchComm);
+                traceSpan(TRACE_SEND_RESULTS, sendStart, results.chunkIndex);
+
+                /* Reset chunk data and receive the next chunk into this buffer (the oldest one, so it's acquired again) */
+                resetChunkData(chunkData);
+                releaseBuffer(&pool);
+                int slot = acquireBuffer(&pool);
+                MPI_Irecv(getBuffer(&pool, slot) + headerOffset, messageSize, MPI_BYTE, 0, MPI_TAG_SEND_CHUNK, dispatchComm, requests + slot);
 
-            /* End worker if all files have been processed */
-            if (workStatus != 0) {
-                break;
             }
-            
+
+            currentSlot = (currentSlot + batchSize) % pipelineDepth;
+
+        }
+
+        stopThreadPool();
+
+        /* Cancel the receives of the chunks that will never be sent */
+        for (int i = 0; i < pipelineDepth; i++) {
+            if (requests[i] != MPI_REQUEST_NULL) {
+                MPI_Cancel(requests + i);
+                MPI_Wait(requests + i, MPI_STATUS_IGNORE);
+            }
+        }
+
+        destroyBufferPool(&pool);
+        freeChunkWindow();
+
+        /* Close the files opened by readChunk() */
+        for (int i = 0; parallelIO && i < numFiles; i++) {
+            if (handles[i] != MPI_FILE_NULL) {
+                MPI_File_close(handles + i);
+            }
+        }
+
+        /* Sum the counters of the words inside the chunks into the results of the dispatcher */
+        if (reduceCounters) {
+            reduceFileCounters(rank, counters);
+        }
+        free(counters);
+
+        /* Merge the word counts with the other ranks */
+        if (topK > 0) {
+            reduceWordCounts(rank, size);
         }
 
     }
 
+    /* Timeline of the ranks (the trace file and the time per phase are written by the dispatcher) */
+    writeTrace(traceFile, isNodeDispatcher);
+
+    MPI_Type_free(&resultsType);
     MPI_Finalize();
     exit(EXIT_SUCCESS);
 
 
 }
 
+/**
+ * @brief Dispatcher sends chunks to a worker until it has pipelineDepth chunks in flight or all files were read.
+ * Each chunk is sent in a single non-blocking message: its header followed by exactly chunkSize bytes, which are
+ * read straight from the memory mapped file through a derived datatype (no copies). The header is kept in a buffer
+ * of the worker's pool until the worker sends the results of the chunk, and the buffer is only reused after its
+ * send completed. The chunks of streams are read into the same buffer, after its first CHUNK_HEADER_SPACE bytes
+ *
+ * If the worker is on the same node, the chunk is put in its buffer of the shared memory window instead (streams are
+ * read straight into it, the chunks of the mapped files are copied once) and only the header is sent
+ *
+ * Rank 0 sends super-chunks to the node dispatchers (messageChunks chunks). A node dispatcher sends the slices of its
+ * super-chunks to the workers of its node the same way (without a tuner), straight from the buffers of the super-chunks
+ *
+ * @param worker rank of the worker in comm
+ * @param comm communicator of the dispatcher with its workers (MPI_COMM_WORLD, or nodeComm for a node dispatcher)
+ * @param pools pool of header buffers of each worker (one buffer per chunk in flight)
+ * @param requests 1 request per buffer
+ * @param tuner chunk size tuning (size of the next chunk), NULL on a node dispatcher (the next slice is sent)
+ * @return false if all files were read (or the node dispatcher has no slices left)
+ */
+bool sendChunks(int worker, MPI_Comm comm, struct bufferPool *pools, MPI_Request *requests, struct chunkTuner *tuner) {
+
+    struct bufferPool *pool = pools + worker;
+    struct fileChunk chunkData;
+
+    while (pool->inUse < pool->numBuffers) {
+
+        MPI_Request *request = requests + worker * pipelineDepth + pool->next;
+
+        /* The previous chunk of this buffer was already processed, so its send is (or will soon be) complete */
+        MPI_Wait(request, MPI_STATUS_IGNORE);
+
+        /* Get chunk data (in the worker's buffer of the shared memory window, the same slot of its ring) */
+        double readStart = traceTime();
+        bool isShared = (sharedPools != NULL && sharedPools[worker].memory != NULL);
+        unsigned char *buffer = NULL;
+        if (isShared) {
+            buffer = getBuffer(sharedPools + worker, pool->next) + CHUNK_HEADER_SPACE;
+        } else if (streamInput && tuner != NULL) {
+            buffer = getBuffer(pool, pool->next) + CHUNK_HEADER_SPACE;
+        }
+        unsigned int chunkSize = (tuner != NULL) ? getChunk(&chunkData, nextChunkSize(tuner) * messageChunks[worker], buffer) : getSlice(&chunkData);
+        if (chunkSize == 0) {
+            return false;
+        }
+        if (isShared) {
+            if (chunkData.chunk != buffer) {
+                memcpy(buffer, chunkData.chunk, chunkData.chunkSize);
+            }
+            MPI_Win_sync(chunkWindow);
+        }
+        if (tuner != NULL) {
+            chunkSent(tuner, chunkData.chunkSize);
+        }
+        traceSpan(TRACE_READ, readStart, chunkData.chunkIndex);
+
+        double sendStart = traceTime();
+        struct chunkHeader *header = (struct chunkHeader *) getBuffer(pool, acquireBuffer(pool));
+        header->fileIndex = chunkData.fileIndex;
+        header->chunkIndex = chunkData.chunkIndex;
+        header->chunkSize = chunkData.chunkSize;
+        header->offset = chunkData.offset;
+
+        /**
+         * Message layout: the header and the chunk, at their absolute addresses. With parallelIO the worker reads
+         * the chunk itself, and a worker on the same node already has it, so only the header is sent
+         */
+        int blockLengths[2] = { sizeof(struct chunkHeader), chunkData.chunkSize };
+        MPI_Aint displacements[2];
+        MPI_Datatype messageType;
+        MPI_Get_address(header, &displacements[0]);
+        MPI_Get_address(chunkData.chunk, &displacements[1]);
+        MPI_Type_create_hindexed((parallelIO || isShared) ? 1 : 2, blockLengths, displacements, MPI_BYTE, &messageType);
+        MPI_Type_commit(&messageType);
+
+        /* Send the header and the chunk to the worker process (the datatype can be freed while the send is pending) */
+        MPI_Isend(MPI_BOTTOM, 1, messageType, worker, MPI_TAG_SEND_CHUNK, comm, request);
+        MPI_Type_free(&messageType);
+        traceSpan(TRACE_SEND, sendStart, chunkData.chunkIndex);
+
+    }
+
+    return true;
+
+}
+
+/**
+ * @brief Splits the ranks by node (MPI_COMM_TYPE_SHARED, in groups of nodeRanks ranks with --node-ranks) for the
+ * two-level dispatch: rank 0 serves the ranks of its node and a node dispatcher on each of the other nodes (their
+ * first rank), which gets super-chunks (a chunk for each worker of its node) and splits them among the workers of its
+ * node, so rank 0 exchanges a single message per super-chunk with each node. A rank alone on its node is a worker of
+ * rank 0. Rank 0 gets the number of chunks of its messages to each rank (messageChunks)
+ *
+ * @param rank rank of the process
+ * @param size number of processes
+ */
+void splitNodes(int rank, int size) {
+
+    MPI_Group worldGroup, nodeGroup;
+    int nodeSize, nodeRank, root = 0, rootOnNode;
+
+    /* The ranks are ordered by their rank in each node, so rank 0 is the first rank of its node */
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+    if (nodeRanks > 0) {
+        MPI_Comm groupComm;
+        MPI_Comm_rank(nodeComm, &nodeRank);
+        MPI_Comm_split(nodeComm, nodeRank / nodeRanks, rank, &groupComm);
+        MPI_Comm_free(&nodeComm);
+        nodeComm = groupComm;
+    }
+    MPI_Comm_size(nodeComm, &nodeSize);
+    MPI_Comm_rank(nodeComm, &nodeRank);
+
+    MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+    MPI_Comm_group(nodeComm, &nodeGroup);
+    MPI_Group_translate_ranks(worldGroup, 1, &root, nodeGroup, &rootOnNode);
+    MPI_Group_free(&worldGroup);
+    MPI_Group_free(&nodeGroup);
+
+    /* The first rank of each node reduces the counters of its node */
+    MPI_Comm_split(MPI_COMM_WORLD, (nodeRank == 0) ? 0 : MPI_UNDEFINED, rank, &leaderComm);
+
+    /* The other nodes with more than one rank have a node dispatcher */
+    if (rootOnNode == MPI_UNDEFINED && nodeSize > 1) {
+        isNodeDispatcher = (nodeRank == 0);
+        dispatchComm = nodeComm;
+        nodeWorkers = nodeSize - 1;
+        superChunkChunks = (nodeWorkers < MAX_SUPER_CHUNK_SIZE / CHUNK_BYTE_LIMIT) ? nodeWorkers : MAX_SUPER_CHUNK_SIZE / CHUNK_BYTE_LIMIT;
+    }
+
+    /* Chunks of the messages of rank 0 to this rank, and if it's a node dispatcher */
+    int role[2] = { (rank == 0 || dispatchComm != MPI_COMM_WORLD) ? 0 : 1, isNodeDispatcher };
+    if (isNodeDispatcher) {
+        role[0] = superChunkChunks;
+    }
+    int *roles = (rank == 0) ? (int *) malloc(2 * size * sizeof(int)) : NULL;
+    MPI_Gather(role, 2, MPI_INT, roles, 2, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        messageChunks = (int *) malloc(size * sizeof(int));
+        for (int i = 0; i < size; i++) {
+            messageChunks[i] = roles[2 * i];
+            numNodeDispatchers += roles[2 * i + 1];
+        }
+        free(roles);
+    }
+
+}
+
+/**
+ * @brief Node dispatcher gets the next slice of its super-chunks, from the oldest super-chunk (in the order of rank 0)
+ * that has slices left. The slice points to the buffer of the super-chunk (no bytes are copied), or only has its byte
+ * range with parallelIO. Its index tells the super-chunk (its buffer) and the slice
+ *
+ * @param chunkData fileChunk structure
+ * @return size of the slice, 0 if the super-chunks that were received have no slices left
+ */
+unsigned int getSlice(struct fileChunk *chunkData) {
+
+    struct superChunk *oldest = NULL;
+    int oldestIndex = 0;
+
+    /* The indexes are compared by their difference, so that the oldest one is still found when the index wraps around */
+    for (int i = 0; i < pipelineDepth; i++) {
+        struct superChunk *super = superChunks + i;
+        if (super->isReceived && super->nextSlice < super->numSlices &&
+            (oldest == NULL || (int) (super->header.chunkIndex - oldest->header.chunkIndex) < 0)) {
+            oldest = super;
+            oldestIndex = i;
+        }
+    }
+    if (oldest == NULL) {
+        return 0;
+    }
+
+    unsigned int start = oldest->nextSlice * oldest->sliceSize;
+    unsigned int end = (start + oldest->sliceSize < oldest->header.chunkSize) ? start + oldest->sliceSize : oldest->header.chunkSize;
+
+    chunkData->fileIndex = oldest->header.fileIndex;
+    chunkData->chunkIndex = oldestIndex * nodeWorkers + oldest->nextSlice;
+    chunkData->offset = oldest->header.offset + start;
+    chunkData->chunk = parallelIO ? NULL : oldest->data + start;
+    chunkData->chunkSize = end - start;
+    chunkData->isFinished = false;
+    oldest->nextSlice++;
+
+    return chunkData->chunkSize;
+
+}
+
+/**
+ * @brief Node dispatcher: it asks rank 0 for super-chunks, like a worker with pipelineDepth super-chunks in flight,
+ * and splits each one into a slice per worker of its node (at least MIN_CHUNK_SIZE bytes), which are sent like the
+ * chunks of rank 0 (sendChunks(), through the shared memory window if there is one). When the results of all the
+ * slices of a super-chunk were received, their summaries are merged in order (the words cut by the slices are counted
+ * here) and sent to rank 0 as the results of the super-chunk, which frees its buffer for the next one. The workers
+ * are told to exit when rank 0 has no super-chunks left
+ *
+ * @param rank rank of the process
+ * @param size number of processes
+ * @param resultsType derived datatype of the chunkResults structure
+ */
+void dispatchNode(int rank, int size, MPI_Datatype resultsType) {
+
+    struct chunkResults results, sliceResults;
+    MPI_Status status;
+    uint64_t *counters = (uint64_t *) calloc(numFiles * getNumFileCounters(), sizeof(uint64_t));
+    size_t superChunkSize = parallelIO ? 0 : (size_t) superChunkChunks * CHUNK_BYTE_LIMIT;
+    int messageSize = sizeof(struct chunkHeader) + superChunkSize;
+    int headerOffset = CHUNK_HEADER_SPACE - sizeof(struct chunkHeader);
+
+    /**
+     * Requests: the next message of a worker (a chunk request or the results of a slice), the end of work message
+     * of rank 0 and the super-chunk of each buffer (the header is received at the end of its first CHUNK_HEADER_SPACE bytes)
+     */
+    MPI_Request *waits = (MPI_Request *) malloc((2 + pipelineDepth) * sizeof(MPI_Request));
+    struct bufferPool superPool;
+    memset(&results, 0, sizeof(struct chunkResults));
+    memset(&sliceResults, 0, sizeof(struct chunkResults));
+    createBufferPool(&superPool, pipelineDepth, CHUNK_HEADER_SPACE + superChunkSize);
+    superChunks = (struct superChunk *) calloc(pipelineDepth, sizeof(struct superChunk));
+    for (int i = 0; i < pipelineDepth; i++) {
+        (superChunks + i)->summaries = (struct chunkSummary *) malloc(nodeWorkers * sizeof(struct chunkSummary));
+        (superChunks + i)->fragments = (struct wordFragments *) calloc(nodeWorkers, sizeof(struct wordFragments));
+        MPI_Irecv(getBuffer(&superPool, i) + headerOffset, messageSize, MPI_BYTE, 0, MPI_TAG_SEND_CHUNK, MPI_COMM_WORLD, waits + 2 + i);
+    }
+    MPI_Irecv(NULL, 0, MPI_BYTE, 0, MPI_TAG_END_WORK, MPI_COMM_WORLD, waits + 1);
+    MPI_Irecv(&sliceResults, 1, resultsType, MPI_ANY_SOURCE, MPI_ANY_TAG, nodeComm, waits);
+
+    /* Ask rank 0 for the first super-chunks */
+    MPI_Send(NULL, 0, MPI_BYTE, 0, MPI_TAG_CHUNK_REQUEST, MPI_COMM_WORLD);
+
+    /* Pipeline of each worker of the node: the headers of its slices in flight (and the requests of their sends) */
+    struct bufferPool *pools = (struct bufferPool *) calloc(nodeWorkers + 1, sizeof(struct bufferPool));
+    MPI_Request *requests = (MPI_Request *) malloc((nodeWorkers + 1) * pipelineDepth * sizeof(MPI_Request));
+    bool *isServed = (bool *) calloc(nodeWorkers + 1, sizeof(bool));     /* Asked for slices, and wasn't told to exit */
+    for (int i = 1; i <= nodeWorkers; i++) {
+        createBufferPool(pools + i, pipelineDepth, sizeof(struct chunkHeader));
+    }
+    for (int i = 0; i < (nodeWorkers + 1) * pipelineDepth; i++) {
+        requests[i] = MPI_REQUEST_NULL;
+    }
+
+    int activeWorkers = nodeWorkers;
+    bool isEnd = false;
+
+    while (activeWorkers > 0) {
+
+        int completed;
+        double waitStart = traceTime();
+        MPI_Waitany(2 + pipelineDepth, waits, &completed, &status);
+        traceSpan(TRACE_WAIT, waitStart, -1);
+
+        if (completed >= 2) {
+
+            /* A super-chunk from rank 0: a slice per worker (the last slice may be shorter) */
+            struct superChunk *super = superChunks + completed - 2;
+            unsigned char *message = getBuffer(&superPool, completed - 2) + headerOffset;
+            memcpy(&super->header, message, sizeof(struct chunkHeader));
+            super->data = parallelIO ? NULL : message + sizeof(struct chunkHeader);
+            super->sliceSize = (super->header.chunkSize + nodeWorkers - 1) / nodeWorkers;
+            if (super->sliceSize < MIN_CHUNK_SIZE) {
+                super->sliceSize = MIN_CHUNK_SIZE;
+            }
+            super->numSlices = (super->header.chunkSize + super->sliceSize - 1) / super->sliceSize;
+            super->nextSlice = 0;
+            super->slicesDone = 0;
+            super->processingTime = 0;
+            super->waitingTime = 0;
+            super->isReceived = true;
+
+            /* Its slices go to the workers that have room in their pipelines */
+            for (int i = 1; i <= nodeWorkers; i++) {
+                if (isServed[i]) {
+                    sendChunks(i, nodeComm, pools, requests, NULL);
+                }
+            }
+
+        } else if (completed == 1) {
+
+            /* Rank 0 has no super-chunks left (the results of all of them were sent) */
+            isEnd = true;
+
+        } else {
+
+            int worker = status.MPI_SOURCE;
+            isServed[worker] = true;
+
+            if (status.MPI_TAG == MPI_TAG_SEND_RESULTS) {
+
+                /* The oldest slice of the worker was processed, so its send is (or will soon be) complete */
+                struct bufferPool *pool = pools + worker;
+                MPI_Wait(requests + worker * pipelineDepth + (pool->next + pool->numBuffers - pool->inUse) % pool->numBuffers, MPI_STATUS_IGNORE);
+                releaseBuffer(pool);
+
+                int superIndex = sliceResults.chunkIndex / nodeWorkers;
+                int slice = sliceResults.chunkIndex % nodeWorkers;
+                struct superChunk *super = superChunks + superIndex;
+                super->summaries[slice] = sliceResults.summary;
+                super->fragments[slice] = sliceResults.fragments;
+                super->processingTime += sliceResults.processingTime;
+                super->waitingTime += sliceResults.waitingTime;
+                super->slicesDone++;
+
+                /* The results of the super-chunk: the summaries of its slices, merged in order */
+                if (super->slicesDone == super->numSlices) {
+
+                    double mergeStart = traceTime();
+                    results.chunkIndex = super->header.chunkIndex;
+                    results.chunkSize = super->header.chunkSize;
+                    results.processingTime = super->processingTime;
+                    results.waitingTime = super->waitingTime / super->numSlices;
+                    results.summary = super->summaries[0];
+                    results.fragments = super->fragments[0];
+                    for (unsigned int i = 1; i < super->numSlices; i++) {
+                        if (topK > 0) {
+                            mergeWordFragments(super->header.fileIndex, &results.fragments, &results.summary, super->fragments + i, super->summaries + i);
+                        }
+                        mergeSummaries(&results.summary, super->summaries + i);
+                    }
+                    traceSpan(TRACE_MERGE, mergeStart, results.chunkIndex);
+
+                    /* Like the workers, the counts of the words cut by the slices are reduced at the end */
+                    if (reduceCounters) {
+                        takeFileCounters(counters + super->header.fileIndex * getNumFileCounters(), &results.summary);
+                    }
+
+                    double sendStart = traceTime();
+                    MPI_Send(&results, 1, resultsType, 0, MPI_TAG_SEND_RESULTS, MPI_COMM_WORLD);
+                    traceSpan(TRACE_SEND_RESULTS, sendStart, results.chunkIndex);
+
+                    /* The buffer receives the next super-chunk */
+                    super->isReceived = false;
+                    MPI_Irecv(getBuffer(&superPool, superIndex) + headerOffset, messageSize, MPI_BYTE, 0, MPI_TAG_SEND_CHUNK, MPI_COMM_WORLD, waits + 2 + superIndex);
+
+                }
+
+            }
+
+            sendChunks(worker, nodeComm, pools, requests, NULL);
+            MPI_Irecv(&sliceResults, 1, resultsType, MPI_ANY_SOURCE, MPI_ANY_TAG, nodeComm, waits);
+
+        }
+
+        /* The workers that have no slices left can exit once rank 0 has no super-chunks left */
+        for (int i = 1; isEnd && i <= nodeWorkers; i++) {
+            if (isServed[i] && pools[i].inUse == 0) {
+                MPI_Send(NULL, 0, MPI_BYTE, i, MPI_TAG_END_WORK, nodeComm);
+                isServed[i] = false;
+                activeWorkers--;
+            }
+        }
+
+    }
+
+    /* All the slices were received by the workers. Cancel the receives of the messages that will never be sent */
+    MPI_Waitall((nodeWorkers + 1) * pipelineDepth, requests, MPI_STATUSES_IGNORE);
+    for (int i = 0; i < 2 + pipelineDepth; i++) {
+        if (waits[i] != MPI_REQUEST_NULL) {
+            MPI_Cancel(waits + i);
+            MPI_Wait(waits + i, MPI_STATUS_IGNORE);
+        }
+    }
+
+    for (int i = 0; i < pipelineDepth; i++) {
+        free((superChunks + i)->summaries);
+        free((superChunks + i)->fragments);
+    }
+    free(superChunks);
+    superChunks = NULL;
+    for (int i = 1; i <= nodeWorkers; i++) {
+        destroyBufferPool(pools + i);
+    }
+    destroyBufferPool(&superPool);
+    free(pools);
+    free(requests);
+    free(isServed);
+    free(waits);
+    freeChunkWindow();
+
+    /* The counters of the words cut by the slices (the words inside them are in the counters of its workers) */
+    if (reduceCounters) {
+        reduceFileCounters(rank, counters);
+    }
+    free(counters);
+    if (topK > 0) {
+        reduceWordCounts(rank, size);
+    }
+
+}
+
 /**
  * @brief prints the usage of the program
  *
  */
 void usage() {
-    printf("Usage:\n\t./prob1 -t <num_threads> -f <file1> <file2> ... <fileN> -c <chunk_size>\n\n");
-    printf("\t-n <num_processes> : Number of processes to be used (1-8)\n");
-    printf("\t-f <file1> <file2> ... <fileN> : List of files to be processed\n");
-    printf("\t-c <chunk_size> : Chunk size (4k or 8k)\n");
-}
\ No newline at end of file
+    printf("Usage:\n\t./prob1 -t <num_threads> -f <file1> <file2> ... <fileN> -c <chunk_size> -k <kernel> -d <depth> -i --stdin --interval <seconds> --stats --trace <file> --top <k> --classes <file> --no-shared --cache <file> --node-ranks <n> --metrics <list>\n\n");
+    printf("\t-n <num_processes> : Number of processes to be used (at least 2, the dispatcher and a worker)\n");
+    printf("\t-f <file1> <file2> ... <fileN> : List of files to be processed (- is stdin)\n");
+    printf("\t-t <num_threads> : Number of threads of each worker (1-%d)\n", MAX_NUM_THREADS);
+    printf("\t-c <chunk_size> : Chunk size in bytes (%d to %d, e.g. 64k or 4M, by default %d), or auto (tuned by the dispatcher)\n", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE, DEFAULT_CHUNK_SIZE);
+    printf("\t-k <kernel> : Kernel used to process the chunks (auto, scalar, sse2 or avx2)\n");
+    printf("\t-d <depth> : Number of chunks in flight per worker (1-%d, by default 2 or twice the number of threads, at most %d MiB of chunks)\n", MAX_PIPELINE_DEPTH, MAX_WORKER_BUFFER_BYTES / (1024 * 1024));
+    printf("\t-i : The workers read their chunks from the files (MPI-IO), the dispatcher only assigns byte ranges\n");
+    printf("\t--stdin : Read stdin (the same as the file -), which can be a pipe. Pipes and FIFOs can be given as files too\n");
+    printf("\t(gzip and zstd files are decompressed while they're read, by a thread of the dispatcher or a zstd process)\n");
+    printf("\t--trace <file> : Record the timeline of each rank (read, send, wait, merge, process and send results spans) into a Chrome/Perfetto trace file\n");
+    printf("\t--stats : Print the throughput statistics (bytes, chunks, MB/s, chunks/s and busy time of the dispatcher and the workers)\n");
+    printf("\t--classes <file> : Spec file of the character classes (vowels, separators and apostrophes, by default the Portuguese ones)\n");
+    printf("\t--no-shared : The workers on the node of the dispatcher get their chunks in messages too (not through a shared memory window)\n");
+    printf("\t--node-ranks <n> : Split the ranks of each node into groups of n, the groups without the dispatcher get a node dispatcher (by default each node is a group)\n");
+    printf("\t--cache <file> : Cache of the results of the files: the unchanged files aren't read again and only the new bytes of the files that grew are processed\n");
+    printf("\t--metrics <list> : Count, in the same pass as the words, the metrics of the list (letters, lengths, vowels, sentences or all, separated by commas)\n");
+    printf("\t--top <k> : Count the (lower case) words and print the k most frequent ones of each file (1-%d)\n", MAX_TOP_WORDS);
+    printf("\t--interval <seconds> : Interval of the running totals of stdin, pipes and FIFOs (by default %.0f, 0 disables them)\n", RUNNING_TOTALS_INTERVAL);
+}
+
+/**
+ * @brief Creates (and commits) the derived datatype that describes the chunkResults structure,
+ * so that the partial results of a chunk are sent in a single message
+ *
+ * @param withMetrics tells if the counters of the metrics are sent (not if there are no metrics, or if they're reduced at the end)
+ * @return MPI_Datatype
+ */
+MPI_Datatype createResultsType(bool withMetrics) {
+
+    int blockLengths[26] = { 1, 1, 1, 1, 1, 6, 1, 1, 1, 1, 1, 1, 1, 3, 1, 3, 1, 1, 1, 1, withMetrics ? NUM_METRIC_COUNTERS : 0,
+                             1, 1, 1, MAX_WORD_BYTES, MAX_WORD_BYTES };
+    MPI_Aint displacements[26] = {
+        offsetof(struct chunkResults, chunkIndex),
+        offsetof(struct chunkResults, chunkSize),
+        offsetof(struct chunkResults, processingTime),
+        offsetof(struct chunkResults, waitingTime),
+        offsetof(struct chunkResults, summary.numWords),
+        offsetof(struct chunkResults, summary.nWordsWithVowel),
+        offsetof(struct chunkResults, summary.hasSeparator),
+        offsetof(struct chunkResults, summary.lead.inWord),
+        offsetof(struct chunkResults, summary.lead.wordVowels),
+        offsetof(struct chunkResults, summary.lead.length),
+        offsetof(struct chunkResults, summary.trail.inWord),
+        offsetof(struct chunkResults, summary.trail.wordVowels),
+        offsetof(struct chunkResults, summary.trail.length),
+        offsetof(struct chunkResults, summary.head),
+        offsetof(struct chunkResults, summary.headSize),
+        offsetof(struct chunkResults, summary.tail),
+        offsetof(struct chunkResults, summary.tailSize),
+        offsetof(struct chunkResults, summary.hasTerminator),
+        offsetof(struct chunkResults, summary.leadSentence),
+        offsetof(struct chunkResults, summary.trailSentence),
+        offsetof(struct chunkResults, summary.metrics),
+        offsetof(struct chunkResults, fragments.hasSeparator),
+        offsetof(struct chunkResults, fragments.leadSize),
+        offsetof(struct chunkResults, fragments.trailSize),
+        offsetof(struct chunkResults, fragments.lead),
+        offsetof(struct chunkResults, fragments.trail)
+    };
+    MPI_Datatype types[26] = {
+        MPI_UNSIGNED, MPI_UNSIGNED, MPI_DOUBLE, MPI_DOUBLE,
+        MPI_UINT64_T, MPI_UINT64_T, MPI_C_BOOL, MPI_C_BOOL, MPI_UNSIGNED, MPI_UNSIGNED, MPI_C_BOOL, MPI_UNSIGNED, MPI_UNSIGNED,
+        MPI_UNSIGNED_CHAR, MPI_UNSIGNED_CHAR, MPI_UNSIGNED_CHAR, MPI_UNSIGNED_CHAR,
+        MPI_C_BOOL, MPI_C_BOOL, MPI_C_BOOL, MPI_UINT64_T,
+        MPI_C_BOOL, MPI_UNSIGNED_CHAR, MPI_UNSIGNED_CHAR, MPI_CHAR, MPI_CHAR
+    };
+    MPI_Datatype structType, resultsType;
+
+    /* The extent is resized to the size of the structure (including its padding) */
+    MPI_Type_create_struct(26, blockLengths, displacements, types, &structType);
+    MPI_Type_create_resized(structType, 0, sizeof(struct chunkResults), &resultsType);
+    MPI_Type_commit(&resultsType);
+    MPI_Type_free(&structType);
+
+    return resultsType;
+
+}
+
+/**
+ * @brief Dispatcher sends the filenames to the workers (in a single buffer, separated by '\0'),
+ * which store them in their own fileInfo structures
+ *
+ * @param rank rank of the process
+ * @param filenames names of the input files (set on the workers)
+ */
+void broadcastFilenames(int rank, char *filenames[]) {
+
+    int length = 0;
+    char *buffer;
+
+    if (rank == 0) {
+        for (int i = 0; i < numFiles; i++) {
+            length += strlen(filenames[i]) + 1;
+        }
+    }
+    MPI_Bcast(&length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    buffer = (char *) malloc(length * sizeof(char));
+    if (rank == 0) {
+        for (int i = 0, position = 0; i < numFiles; i++) {
+            strcpy(buffer + position, filenames[i]);
+            position += strlen(filenames[i]) + 1;
+        }
+    }
+    MPI_Bcast(buffer, length, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    if (rank != 0) {
+        for (int i = 0, position = 0; i < numFiles; i++) {
+            filenames[i] = buffer + position;
+            position += strlen(filenames[i]) + 1;
+        }
+        files = (struct fileInfo *) malloc(numFiles * sizeof(struct fileInfo));
+        storeFilenames(files, filenames);
+    } else {
+        free(buffer);
+    }
+
+}
+
+/**
+ * @brief Dispatcher sends the character classes (the code point ranges of each class) to the workers, which
+ * compile them into their own lookup tables and DFA
+ *
+ * @param rank rank of the process
+ */
+void broadcastCharClasses(int rank) {
+
+    int numRanges;
+    const struct classRange *ranges = getCharClassRanges(&numRanges);
+    struct classRange *buffer;
+
+    MPI_Bcast(&numRanges, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    buffer = (struct classRange *) malloc((numRanges + 1) * sizeof(struct classRange));
+    if (rank == 0) {
+        memcpy(buffer, ranges, numRanges * sizeof(struct classRange));
+    }
+
+    /* The ranges are sent as raw bytes (all the ranks have the same architecture) */
+    MPI_Bcast(buffer, numRanges * sizeof(struct classRange), MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        setCharClasses(buffer, numRanges);
+    }
+    free(buffer);
+
+}
+
+/**
+ * @brief Worker reads the byte range [offset, offset + chunkSize) of a chunk with MPI-IO. The file is opened
+ * the first time one of its chunks is read
+ *
+ * @param header header received from the dispatcher (byte range of the chunk)
+ * @param handles MPI-IO file handles of the worker (MPI_FILE_NULL if the file isn't open yet)
+ * @param buffer buffer with space for CHUNK_BYTE_LIMIT bytes
+ * @param chunkData fileChunk structure whose chunk is set
+ */
+void readChunk(struct chunkHeader *header, MPI_File *handles, unsigned char *buffer, struct fileChunk *chunkData) {
+
+    struct fileInfo *file = files + header->fileIndex;
+    MPI_File *handle = handles + header->fileIndex;
+
+    if (*handle == MPI_FILE_NULL) {
+        if (MPI_File_open(MPI_COMM_SELF, file->filename, MPI_MODE_RDONLY, MPI_INFO_NULL, handle) != MPI_SUCCESS) {
+            fprintf(stderr, "[ERROR] Can't open file %s\n", file->filename);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+
+    MPI_File_read_at(*handle, header->offset, buffer, header->chunkSize, MPI_BYTE, MPI_STATUS_IGNORE);
+    chunkData->chunk = buffer;
+
+}
+
+/**
+ * @brief The ranks of each node with a dispatcher (rank 0 or a node dispatcher, the first rank of nodeComm) allocate a
+ * shared memory window with the chunk buffers of each worker (a ring of pipelineDepth buffers, like its bufferPool),
+ * so that the dispatcher can put the chunks in place and only send their headers. Each rank of the node maps the
+ * buffers of all the workers of the node into sharedPools, by their rank for their dispatcher (in MPI_COMM_WORLD on
+ * the node of rank 0, in nodeComm on the other nodes). A rank alone on its node doesn't allocate anything
+ *
+ * @param size number of processes
+ */
+void createChunkWindow(int size) {
+
+    MPI_Group worldGroup, nodeGroup;
+    int nodeSize, nodeRank, root = 0, rootOnNode;
+    size_t bufferSize = CHUNK_HEADER_SPACE + CHUNK_BYTE_LIMIT;
+
+    sharedPools = (struct bufferPool *) calloc(size, sizeof(struct bufferPool));
+
+    /* The ranks that share memory with this one, and the rank of rank 0 among them (if it's one of them) */
+    MPI_Comm_size(nodeComm, &nodeSize);
+    MPI_Comm_rank(nodeComm, &nodeRank);
+    MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+    MPI_Comm_group(nodeComm, &nodeGroup);
+    MPI_Group_translate_ranks(worldGroup, 1, &root, nodeGroup, &rootOnNode);
+
+    if (nodeSize > 1) {
+
+        /* The buffers of each worker are allocated by itself, with room to align them (the dispatcher has none) */
+        MPI_Aint windowSize = (nodeRank == 0) ? 0 : pipelineDepth * bufferPoolStride(bufferSize) + POOL_ALIGNMENT;
+        unsigned char *memory;
+        MPI_Info info;
+        MPI_Info_create(&info);
+        MPI_Info_set(info, "alloc_shared_noncontig", "true");
+        MPI_Win_allocate_shared(windowSize, 1, info, nodeComm, &memory, &chunkWindow);
+        MPI_Info_free(&info);
+
+        /* A single passive epoch for the whole run: the chunks are synchronized by the messages (and MPI_Win_sync) */
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, chunkWindow);
+
+        int *nodeRanks = (int *) malloc(nodeSize * sizeof(int));
+        int *workerRanks = (int *) malloc(nodeSize * sizeof(int));
+        for (int i = 0; i < nodeSize; i++) {
+            nodeRanks[i] = i;
+            workerRanks[i] = i;
+        }
+        if (rootOnNode != MPI_UNDEFINED) {
+            MPI_Group_translate_ranks(nodeGroup, nodeSize, nodeRanks, worldGroup, workerRanks);
+        }
+
+        for (int i = 1; i < nodeSize; i++) {
+            MPI_Aint segmentSize;
+            int displacementUnit;
+            unsigned char *segment;
+            MPI_Win_shared_query(chunkWindow, i, &segmentSize, &displacementUnit, &segment);
+            /* The window is mapped at a page boundary by every rank, so the aligned buffers are the same ones */
+            segment = (unsigned char *) (((uintptr_t) segment + POOL_ALIGNMENT - 1) & ~((uintptr_t) POOL_ALIGNMENT - 1));
+            attachBufferPool(sharedPools + workerRanks[i], pipelineDepth, bufferSize, segment);
+        }
+
+        free(nodeRanks);
+        free(workerRanks);
+
+    }
+
+    MPI_Group_free(&worldGroup);
+    MPI_Group_free(&nodeGroup);
+
+}
+
+/**
+ * @brief Frees the shared memory window of the chunk buffers (collective over the ranks of the node of the dispatcher)
+ *
+ */
+void freeChunkWindow() {
+
+    if (chunkWindow != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(chunkWindow);
+        MPI_Win_free(&chunkWindow);
+    }
+    free(sharedPools);
+    sharedPools = NULL;
+
+}
+
+/**
+ * @brief Get the number of counters of each file kept by the workers and reduced at the end: the words and the words
+ * with each vowel, and the counters of the metrics if there are metrics (--metrics)
+ *
+ * @return number of counters
+ */
+int getNumFileCounters() {
+
+    return NUM_FILE_COUNTERS + ((metricsMask != 0) ? NUM_METRIC_COUNTERS : 0);
+
+}
+
+/**
+ * @brief Moves the additive counts of a summary (the words, the words with each vowel and the metrics) into the
+ * counters of its file, which are reduced at the end, so that only the ends of the range are merged in order
+ *
+ * @param fileCounters getNumFileCounters() counters of the file (updated)
+ * @param summary summary of a range of the file (its counts are set to zero)
+ */
+void takeFileCounters(uint64_t *fileCounters, struct chunkSummary *summary) {
+
+    fileCounters[0] += summary->numWords;
+    summary->numWords = 0;
+    for (int j = 0; j < 6; j++) {
+        fileCounters[j + 1] += summary->nWordsWithVowel[j];
+        summary->nWordsWithVowel[j] = 0;
+    }
+    for (int j = 0; metricsMask != 0 && j < NUM_METRIC_COUNTERS; j++) {
+        fileCounters[NUM_FILE_COUNTERS + j] += summary->metrics.counters[j];
+        summary->metrics.counters[j] = 0;
+    }
+
+}
+
+/**
+ * @brief Sums the counters of the words inside the chunks of each file (kept by each worker) into the results of the
+ * files of the dispatcher, with a reduction per node and one of the nodes. The dispatcher merged the summaries of the
+ * chunks without their counts, so the results (and the summaries, which are saved by --cache) only have the words cut
+ * by the chunks until then
+ *
+ * @param rank rank of the process
+ * @param counters numFiles * getNumFileCounters() counters: the words, the words with each vowel and the metrics (zeros
+ * on rank 0, the words cut by the slices on the node dispatchers)
+ */
+void reduceFileCounters(int rank, uint64_t *counters) {
+
+    int nodeRank, numCounters = getNumFileCounters();
+    MPI_Comm_rank(nodeComm, &nodeRank);
+
+    /* The counters of each node are reduced into its first rank, and then the ones of the nodes into rank 0 */
+    MPI_Reduce((nodeRank == 0) ? MPI_IN_PLACE : counters, counters, numFiles * numCounters, MPI_UINT64_T, MPI_SUM, 0, nodeComm);
+    if (leaderComm != MPI_COMM_NULL) {
+        MPI_Reduce((rank == 0) ? MPI_IN_PLACE : counters, counters, numFiles * numCounters, MPI_UINT64_T, MPI_SUM, 0, leaderComm);
+    }
+
+    if (rank == 0) {
+        for (int i = 0; i < numFiles; i++) {
+            uint64_t *fileCounters = counters + i * numCounters;
+            (files + i)->numWords += fileCounters[0];
+            (files + i)->summary.numWords += fileCounters[0];
+            for (int j = 0; j < 6; j++) {
+                (files + i)->nWordsWithVowel[j] += fileCounters[j + 1];
+                (files + i)->summary.nWordsWithVowel[j] += fileCounters[j + 1];
+            }
+            for (int j = 0; metricsMask != 0 && j < NUM_METRIC_COUNTERS; j++) {
+                (files + i)->metrics.counters[j] += fileCounters[NUM_FILE_COUNTERS + j];
+                (files + i)->summary.metrics.counters[j] += fileCounters[NUM_FILE_COUNTERS + j];
+            }
+        }
+    }
+
+}
+
+/**
+ * @brief Callback of MPI_Reduce that merges the lists of the most frequent words of two ranks (a single element
+ * of the datatype is a list of topK words per file, so the reduction is never split inside a list)
+ *
+ * @param in list of a rank
+ * @param inout list of another rank (updated)
+ * @param length number of lists
+ * @param type datatype of a list
+ */
+void mergeTopWordsOp(void *in, void *inout, int *length, MPI_Datatype *type) {
+
+    for (int i = 0; i < *length; i++) {
+        mergeTopWords((struct wordCount *) inout + i * numFiles * topK, (struct wordCount *) in + i * numFiles * topK, topK);
+    }
+
+}
+
+/**
+ * @brief All ranks merge their word counts and reduce the most frequent words of each file into the dispatcher.
+ * The word counts are split by the hash of the words (MPI_Alltoallv), so that each rank merges the counts of its
+ * share of the vocabulary, and the topK words of each file of every rank are reduced (MPI_Reduce, which is a tree)
+ *
+ * @param rank rank of the process
+ * @param size number of processes
+ * @return topK word counts per file, from the most to the least frequent (rank 0, NULL on the other ranks)
+ */
+struct wordCount *reduceWordCounts(int rank, int size) {
+
+    int *sendCounts = (int *) malloc(size * sizeof(int));
+    int *sendDisplacements = (int *) malloc(size * sizeof(int));
+    int *receiveCounts = (int *) malloc(size * sizeof(int));
+    int *receiveDisplacements = (int *) malloc(size * sizeof(int));
+    MPI_Datatype recordType, listType;
+    MPI_Op mergeOp;
+
+    /* The word counts are sent as raw bytes (all the ranks have the same architecture) */
+    MPI_Type_contiguous(sizeof(struct wordCount), MPI_BYTE, &recordType);
+    MPI_Type_commit(&recordType);
+
+    struct wordCount *records = partitionWordCounts(size, sendCounts);
+    MPI_Alltoall(sendCounts, 1, MPI_INT, receiveCounts, 1, MPI_INT, MPI_COMM_WORLD);
+
+    int numReceived = 0;
+    for (int i = 0, numSent = 0; i < size; i++) {
+        sendDisplacements[i] = numSent;
+        receiveDisplacements[i] = numReceived;
+        numSent += sendCounts[i];
+        numReceived += receiveCounts[i];
+    }
+    struct wordCount *received = (struct wordCount *) malloc((numReceived + 1) * sizeof(struct wordCount));
+    if (received == NULL) {
+        printf("[ERROR] Can't allocate memory for the word counts\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Alltoallv(records, sendCounts, sendDisplacements, recordType, received, receiveCounts, receiveDisplacements, recordType, MPI_COMM_WORLD);
+    free(records);
+
+    /* Counts of the share of the vocabulary of this rank */
+    addWordCounts(received, numReceived);
+    free(received);
+
+    struct wordCount *top = (struct wordCount *) malloc(numFiles * topK * sizeof(struct wordCount));
+    selectTopWords(top, topK);
+
+    MPI_Type_contiguous(numFiles * topK, recordType, &listType);
+    MPI_Type_commit(&listType);
+    MPI_Op_create(mergeTopWordsOp, 1, &mergeOp);
+    MPI_Reduce((rank == 0) ? MPI_IN_PLACE : top, top, 1, listType, mergeOp, 0, MPI_COMM_WORLD);
+    MPI_Op_free(&mergeOp);
+    MPI_Type_free(&listType);
+    MPI_Type_free(&recordType);
+
+    free(sendCounts);
+    free(sendDisplacements);
+    free(receiveCounts);
+    free(receiveDisplacements);
+
+    if (rank != 0) {
+        free(top);
+        return NULL;
+    }
+
+    return top;
+
+}
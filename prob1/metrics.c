@@ -0,0 +1,383 @@
+/**
+ * @file metrics.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Metrics of the fused single pass (--metrics): letter frequencies, word lengths, occurrences of each vowel
+ * and sentences
+ *
+ * With --metrics, processChunk() reads the characters after the first separator of a chunk with a fused kernel,
+ * which counts the words and the words with each vowel and all the metrics in the same pass over the bytes. The
+ * counters are in the summary of the chunk (struct textMetrics), so they are merged with mergeSummaries(), like the
+ * number of words:
+ * - letters: the letters 'a' to 'z', in any case and with the diacritics of Latin-1 removed ('Ç' is a 'c');
+ * - vowels: every character of each vowel class (not only once per word);
+ * - word lengths: number of characters of each word ended by a separator, without its apostrophes (the words
+ *   of MAX_WORD_LENGTH or more characters are in the last bin), so the bins add up to the number of words;
+ * - sentences: a run of terminators ('.', '!', '?' or '…') ends a sentence if there's a word character since the
+ *   previous terminator (the start of the file is a terminator, and a sentence without a terminator at the end of
+ *   the file isn't counted, like the last word).
+ * The letters and the terminators don't depend on the character classes (--classes), the vowels and the words do.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "classes.h"
+#include "metrics.h"
+
+/* Metrics selected with --metrics (0 if there are none) */
+extern int metricsMask;
+
+/* Letter of each code point from U+00C0 to U+00FF, without its diacritic ('-' if it isn't one of 'a' to 'z') */
+static const char latinLetters[64] = "aaaaaa-ceeeeiiiidnooooo-ouuuuy--aaaaaa-ceeeeiiiidnooooo-ouuuuy-y";
+
+/* Description of each ASCII character for the fused kernel (set by initMetrics()), see describeCharacter() */
+static uint16_t asciiCharacters[128];
+
+/** @brief Fields of the description of a character: class, letter + 1 (0 if it isn't a letter) and terminator */
+#define CHARACTER_CLASS(description) ((description) & 0x0F)
+#define CHARACTER_LETTER(description) (((description) >> 4) & 0x1F)
+#define CHARACTER_TERMINATOR(description) ((description) >> 9)
+
+
+/**
+ * @brief Get the bitmask of the metrics from their names
+ *
+ * @param list names separated by commas: "letters", "lengths", "vowels", "sentences" or "all"
+ * @return METRIC_* bitmask, -1 if a name is not valid
+ */
+int parseMetrics(const char *list) {
+
+    const char *names[5] = { "letters", "lengths", "vowels", "sentences", "all" };
+    const int masks[5] = { METRIC_LETTERS, METRIC_LENGTHS, METRIC_VOWELS, METRIC_SENTENCES, METRIC_ALL };
+    int mask = 0;
+
+    while (true) {
+
+        size_t length = strcspn(list, ",");
+        int metric = -1;
+        for (int i = 0; i < 5 && metric < 0; i++) {
+            if (strlen(names[i]) == length && strncmp(list, names[i], length) == 0) {
+                metric = i;
+            }
+        }
+        if (metric < 0) {
+            return -1;
+        }
+        mask |= masks[metric];
+
+        if (list[length] == '\0') {
+            break;
+        }
+        list += length + 1;
+
+    }
+
+    return mask;
+
+}
+
+
+/**
+ * @brief Get the letter of a character
+ *
+ * @param codePoint code point of the character
+ * @return index of the letter (0 for 'a' to 25 for 'z'), -1 if it isn't a letter
+ */
+static inline int getLetter(unsigned int codePoint) {
+
+    if (codePoint - 'a' < 26) {
+        return codePoint - 'a';
+    }
+    if (codePoint - 'A' < 26) {
+        return codePoint - 'A';
+    }
+    if (codePoint - 0xC0 < 64 && latinLetters[codePoint - 0xC0] != '-') {
+        return latinLetters[codePoint - 0xC0] - 'a';
+    }
+    return -1;
+
+}
+
+
+/**
+ * @brief Tells if a character ends a sentence
+ *
+ * @param codePoint code point of the character
+ * @return true for '.', '!', '?' and '…'
+ */
+static inline bool isTerminator(unsigned int codePoint) {
+
+    return codePoint == '.' || codePoint == '!' || codePoint == '?' || codePoint == 0x2026;
+
+}
+
+
+/**
+ * @brief Get the description of a character used by the fused kernel: its class, its letter and if it's a terminator
+ *
+ * @param codePoint code point of the character
+ * @return class | (letter + 1) << 4 | terminator << 9
+ */
+static inline unsigned int describeCharacter(unsigned int codePoint) {
+
+    return getCharClass(codePoint) | (getLetter(codePoint) + 1) << 4 | isTerminator(codePoint) << 9;
+
+}
+
+
+/**
+ * @brief Sets up the fused kernel once the character classes are set: the description of the ASCII characters,
+ * so that they're described with a table lookup
+ *
+ */
+void initMetrics() {
+
+    for (unsigned int byte = 0; byte < 128; byte++) {
+        asciiCharacters[byte] = describeCharacter(byte);
+    }
+
+}
+
+
+/**
+ * @brief Counts the letter, the vowel and the sentence terminator of a character that isn't read by the fused kernel
+ * (the characters before the first separator of a range and the characters cut by the ends of the ranges)
+ *
+ * @param summary summary of the range (updated)
+ * @param codePoint code point of the character
+ * @param charClass class of the character
+ */
+void countMetrics(struct chunkSummary *summary, unsigned int codePoint, int charClass) {
+
+    uint64_t *counters = summary->metrics.counters;
+    int letter = getLetter(codePoint);
+
+    if (letter >= 0) {
+        counters[METRIC_COUNTER_LETTERS + letter] += 1;
+    }
+    if (charClass <= CHAR_CLASS_Y) {
+        counters[METRIC_COUNTER_VOWELS + charClass] += 1;
+    }
+
+    /* Before the first terminator the sentence is only saved, it's counted when the range is merged */
+    if (isTerminator(codePoint)) {
+        if (summary->hasTerminator) {
+            counters[METRIC_COUNTER_SENTENCES] += summary->trailSentence;
+        }
+        summary->hasTerminator = true;
+        summary->trailSentence = false;
+    } else if (charClass <= CHAR_CLASS_Y || charClass == CHAR_CLASS_OTHER) {
+        if (summary->hasTerminator) {
+            summary->trailSentence = true;
+        } else {
+            summary->leadSentence = true;
+        }
+    }
+
+}
+
+
+/**
+ * @brief Counts a word that was ended in the word length distribution
+ *
+ * @param metrics counters (updated)
+ * @param length number of characters of the word
+ */
+void countWordLength(struct textMetrics *metrics, unsigned int length) {
+
+    metrics->counters[METRIC_COUNTER_LENGTHS + (length < MAX_WORD_LENGTH ? length : MAX_WORD_LENGTH) - 1] += 1;
+
+}
+
+
+/**
+ * @brief Merges the metrics of the range that follows the range of left into left: the counters are added, and the
+ * first terminator of right ends the sentence left open by left (the word lengths are merged by mergeSummaries())
+ *
+ * @param left summary of the first range (updated)
+ * @param right summary of the next range
+ */
+void appendMetrics(struct chunkSummary *left, const struct chunkSummary *right) {
+
+    for (int j = 0; j < NUM_METRIC_COUNTERS; j++) {
+        left->metrics.counters[j] += right->metrics.counters[j];
+    }
+
+    if (!right->hasTerminator) {
+        if (left->hasTerminator) {
+            left->trailSentence |= right->leadSentence;
+        } else {
+            left->leadSentence |= right->leadSentence;
+        }
+        return;
+    }
+
+    if (!left->hasTerminator) {
+        /* Left has no sentences yet, the lead of both is the lead of the merged range */
+        left->leadSentence |= right->leadSentence;
+        left->hasTerminator = true;
+    } else if (left->trailSentence || right->leadSentence) {
+        left->metrics.counters[METRIC_COUNTER_SENTENCES] += 1;
+    }
+    left->trailSentence = right->trailSentence;
+
+}
+
+
+/**
+ * @brief Fused kernel of processChunk() (--metrics), which counts the words and the words with each vowel and the
+ * metrics in a single pass over the characters between the byte indexes start and end. The counters are kept in
+ * a block of whole cache lines on the stack of the thread, and added to the summary of the chunk at the end
+ *
+ * @param chunkData
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+void processChunkMetrics(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) {
+
+    struct chunkSummary *summary = &chunkData->summary;
+    const unsigned char *chunk = chunkData->chunk;
+    _Alignas(CACHE_LINE_SIZE) struct textMetrics metrics;
+    uint64_t *counters = metrics.counters;
+    uint64_t numWords = 0, nWordsWithVowel[6] = { 0 };
+    struct wordState word = *state;
+    bool hasTerminator = summary->hasTerminator;
+    bool inSentence = hasTerminator ? summary->trailSentence : summary->leadSentence;
+
+    memset(&metrics, 0, sizeof(struct textMetrics));
+
+    for (unsigned int i = start; i < end; ) {
+
+        /* ASCII fast path, the description of the byte is in a table */
+        unsigned int description;
+        if (chunk[i] < 0x80) {
+            description = asciiCharacters[chunk[i]];
+            i++;
+        } else {
+            unsigned int length = getCharLength(chunk + i, end - i);
+            if (length > end - i) {
+                length = end - i;
+            }
+            description = describeCharacter(decodeUTF8(chunk + i, length));
+            i += length;
+        }
+        int charClass = CHARACTER_CLASS(description);
+
+        /* Words, words with each vowel (once per word), occurrences of each vowel and word lengths */
+        if (charClass <= CHAR_CLASS_Y) {
+            word.inWord = true;
+            word.length++;
+            if (!(word.wordVowels & (1u << charClass))) {
+                nWordsWithVowel[charClass] += 1;
+                word.wordVowels |= 1u << charClass;
+            }
+            counters[METRIC_COUNTER_VOWELS + charClass] += 1;
+        } else if (charClass == CHAR_CLASS_SEPARATOR) {
+            if (word.inWord) {
+                numWords += 1;
+                counters[METRIC_COUNTER_LENGTHS + (word.length < MAX_WORD_LENGTH ? word.length : MAX_WORD_LENGTH) - 1] += 1;
+                word.inWord = false;
+                word.wordVowels = 0;
+                word.length = 0;
+            }
+        } else if (charClass == CHAR_CLASS_OTHER) {
+            word.inWord = true;
+            word.length++;
+        }
+
+        /* Letters */
+        if (CHARACTER_LETTER(description)) {
+            counters[METRIC_COUNTER_LETTERS + CHARACTER_LETTER(description) - 1] += 1;
+        }
+
+        /* Sentences (the first terminator of the range is counted when the range is merged) */
+        if (CHARACTER_TERMINATOR(description)) {
+            if (hasTerminator) {
+                counters[METRIC_COUNTER_SENTENCES] += inSentence;
+            } else {
+                summary->leadSentence = inSentence;
+                hasTerminator = true;
+            }
+            inSentence = false;
+        } else if (charClass <= CHAR_CLASS_Y || charClass == CHAR_CLASS_OTHER) {
+            inSentence = true;
+        }
+
+    }
+
+    *state = word;
+    summary->numWords += numWords;
+    for (int j = 0; j < 6; j++) {
+        summary->nWordsWithVowel[j] += nWordsWithVowel[j];
+    }
+    for (int j = 0; j < NUM_METRIC_COUNTERS; j++) {
+        summary->metrics.counters[j] += counters[j];
+    }
+    if (hasTerminator) {
+        summary->trailSentence = inSentence;
+    } else {
+        summary->leadSentence = inSentence;
+    }
+    summary->hasTerminator = hasTerminator;
+
+}
+
+
+/**
+ * @brief Prints the metrics of a file that were selected with --metrics
+ *
+ * @param file file whose results were set
+ */
+void printMetrics(const struct fileInfo *file) {
+
+    const uint64_t *counters = file->metrics.counters;
+
+    if (metricsMask & METRIC_VOWELS) {
+        printf("Occurrences of each vowel\n");
+        printf("%10c %10c %10c %10c %10c %10c\n", 'A', 'E', 'I', 'O', 'U', 'Y');
+        for (int j = 0; j < 6; j++) {
+            printf("%10" PRIu64 "%s", counters[METRIC_COUNTER_VOWELS + j], (j < 5) ? " " : "\n");
+        }
+    }
+
+    if (metricsMask & METRIC_LETTERS) {
+        printf("Letter frequencies\n");
+        for (int row = 0; row < 26; row += 13) {
+            for (int j = row; j < row + 13; j++) {
+                printf("%10c%s", 'A' + j, (j < row + 12) ? " " : "\n");
+            }
+            for (int j = row; j < row + 13; j++) {
+                printf("%10" PRIu64 "%s", counters[METRIC_COUNTER_LETTERS + j], (j < row + 12) ? " " : "\n");
+            }
+        }
+    }
+
+    if (metricsMask & METRIC_LENGTHS) {
+        printf("Number of words of each length (characters)\n");
+        for (int row = 0; row < MAX_WORD_LENGTH; row += 10) {
+            int last = (row + 10 < MAX_WORD_LENGTH) ? row + 10 : MAX_WORD_LENGTH;
+            for (int j = row; j < last; j++) {
+                if (j + 1 < MAX_WORD_LENGTH) {
+                    printf("%10d%s", j + 1, (j < last - 1) ? " " : "\n");
+                } else {
+                    printf("%9d+%s", j + 1, (j < last - 1) ? " " : "\n");
+                }
+            }
+            for (int j = row; j < last; j++) {
+                printf("%10" PRIu64 "%s", counters[METRIC_COUNTER_LENGTHS + j], (j < last - 1) ? " " : "\n");
+            }
+        }
+    }
+
+    if (metricsMask & METRIC_SENTENCES) {
+        printf("Number of sentences: %" PRIu64 "\n", counters[METRIC_COUNTER_SENTENCES]);
+    }
+
+}
@@ -0,0 +1,74 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the metrics of the fused single pass (--metrics): letter frequencies, word lengths, occurrences
+ *  of each vowel and sentences.
+ *
+ */
+
+#include "utils.h"
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * @brief Get the bitmask of the metrics from their names
+ *
+ * @param list names separated by commas: "letters", "lengths", "vowels", "sentences" or "all"
+ * @return METRIC_* bitmask, -1 if a name is not valid
+ */
+extern int parseMetrics(const char *list);
+
+/**
+ * @brief Sets up the fused kernel once the character classes are set: the description of the ASCII characters,
+ * so that they're described with a table lookup
+ *
+ */
+extern void initMetrics();
+
+/**
+ * @brief Counts the letter, the vowel and the sentence terminator of a character that isn't read by the fused kernel
+ * (the characters before the first separator of a range and the characters cut by the ends of the ranges)
+ *
+ * @param summary summary of the range (updated)
+ * @param codePoint code point of the character
+ * @param charClass class of the character
+ */
+extern void countMetrics(struct chunkSummary *summary, unsigned int codePoint, int charClass);
+
+/**
+ * @brief Counts a word that was ended in the word length distribution
+ *
+ * @param metrics counters (updated)
+ * @param length number of characters of the word
+ */
+extern void countWordLength(struct textMetrics *metrics, unsigned int length);
+
+/**
+ * @brief Merges the metrics of the range that follows the range of left into left: the counters are added, and the
+ * first terminator of right ends the sentence left open by left (the word lengths are merged by mergeSummaries())
+ *
+ * @param left summary of the first range (updated)
+ * @param right summary of the next range
+ */
+extern void appendMetrics(struct chunkSummary *left, const struct chunkSummary *right);
+
+/**
+ * @brief Fused kernel of processChunk() (--metrics), which counts the words and the words with each vowel and the
+ * metrics in a single pass over the characters between the byte indexes start and end
+ *
+ * @param chunkData
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+extern void processChunkMetrics(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
+
+/**
+ * @brief Prints the metrics of a file that were selected with --metrics
+ *
+ * @param file file whose results were set
+ */
+extern void printMetrics(const struct fileInfo *file);
+
+#endif /* METRICS_H */
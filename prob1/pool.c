@@ -0,0 +1,139 @@
+/**
+ * @file pool.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Pool of reusable (aligned) chunk buffers
+ *
+ * The chunks in flight are always acquired and released in the same order (the dispatcher sends the chunks
+ * of a worker in order and the worker processes them in order), so the pool is a ring of buffers allocated
+ * once, sized to the pipeline depth: processing the chunks doesn't allocate any memory.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "pool.h"
+
+
+/**
+ * @brief Distance between the buffers of a pool: every buffer starts at a multiple of POOL_ALIGNMENT
+ *
+ * @param bufferSize size of each buffer (in bytes)
+ * @return stride of the buffers (in bytes)
+ */
+size_t bufferPoolStride(size_t bufferSize) {
+
+    return (bufferSize + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+
+}
+
+/**
+ * @brief Allocates the buffers of a pool (the only allocation of the pool)
+ *
+ * @param pool bufferPool structure
+ * @param numBuffers number of buffers
+ * @param bufferSize size of each buffer (in bytes)
+ */
+void createBufferPool(struct bufferPool *pool, int numBuffers, size_t bufferSize) {
+
+    pool->bufferStride = bufferPoolStride(bufferSize);
+    pool->numBuffers = numBuffers;
+    pool->next = 0;
+    pool->inUse = 0;
+    pool->highWaterMark = 0;
+    pool->ownsMemory = true;
+
+    if (posix_memalign((void **) &pool->memory, POOL_ALIGNMENT, numBuffers * pool->bufferStride) != 0) {
+        printf("[ERROR] Can't allocate the buffer pool (%d buffers of %zu bytes)\n", numBuffers, bufferSize);
+        exit(1);
+    }
+
+}
+
+
+/**
+ * @brief Sets up a pool over memory allocated elsewhere (e.g. a shared memory window), which isn't freed by the pool
+ *
+ * @param pool bufferPool structure
+ * @param numBuffers number of buffers
+ * @param bufferSize size of each buffer (in bytes)
+ * @param memory numBuffers * bufferPoolStride(bufferSize) bytes, aligned to POOL_ALIGNMENT
+ */
+void attachBufferPool(struct bufferPool *pool, int numBuffers, size_t bufferSize, unsigned char *memory) {
+
+    pool->bufferStride = bufferPoolStride(bufferSize);
+    pool->numBuffers = numBuffers;
+    pool->next = 0;
+    pool->inUse = 0;
+    pool->highWaterMark = 0;
+    pool->ownsMemory = false;
+    pool->memory = memory;
+
+}
+
+/**
+ * @brief Acquires the next buffer of the ring
+ *
+ * @param pool bufferPool structure
+ * @return index of the buffer, -1 if all the buffers are in use
+ */
+int acquireBuffer(struct bufferPool *pool) {
+
+    if (pool->inUse == pool->numBuffers) {
+        return -1;
+    }
+
+    int index = pool->next;
+    pool->next = (pool->next + 1) % pool->numBuffers;
+    pool->inUse++;
+    if (pool->inUse > pool->highWaterMark) {
+        pool->highWaterMark = pool->inUse;
+    }
+
+    return index;
+
+}
+
+
+/**
+ * @brief Releases the oldest buffer in use, so that it can be acquired again
+ *
+ * @param pool bufferPool structure
+ */
+void releaseBuffer(struct bufferPool *pool) {
+
+    if (pool->inUse > 0) {
+        pool->inUse--;
+    }
+
+}
+
+
+/**
+ * @brief Get a buffer of the pool
+ *
+ * @param pool bufferPool structure
+ * @param index index of the buffer
+ * @return first byte of the buffer
+ */
+unsigned char *getBuffer(struct bufferPool *pool, int index) {
+
+    return pool->memory + index * pool->bufferStride;
+
+}
+
+
+/**
+ * @brief Frees the buffers of a pool
+ *
+ * @param pool bufferPool structure
+ */
+void destroyBufferPool(struct bufferPool *pool) {
+
+    if (pool->ownsMemory) {
+        free(pool->memory);
+    }
+    pool->memory = NULL;
+
+}
@@ -0,0 +1,86 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the pool of reusable (aligned) chunk buffers.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * @brief Fixed-size ring of aligned buffers, which are acquired and released in the same (ring) order
+ *
+ */
+struct bufferPool {
+    unsigned char *memory;      /* numBuffers buffers of bufferStride bytes (aligned to POOL_ALIGNMENT) */
+    size_t bufferStride;
+    int numBuffers;
+    int next;                   /* Index of the next buffer to be acquired */
+    int inUse;                  /* Number of buffers acquired and not released yet */
+    int highWaterMark;          /* Maximum number of buffers in use at the same time */
+    bool ownsMemory;            /* The memory was allocated by the pool (not attached) */
+};
+
+/**
+ * @brief Distance between the buffers of a pool: every buffer starts at a multiple of POOL_ALIGNMENT
+ *
+ * @param bufferSize size of each buffer (in bytes)
+ * @return stride of the buffers (in bytes)
+ */
+extern size_t bufferPoolStride(size_t bufferSize);
+
+/**
+ * @brief Allocates the buffers of a pool (the only allocation of the pool)
+ *
+ * @param pool bufferPool structure
+ * @param numBuffers number of buffers
+ * @param bufferSize size of each buffer (in bytes)
+ */
+extern void createBufferPool(struct bufferPool *pool, int numBuffers, size_t bufferSize);
+
+/**
+ * @brief Sets up a pool over memory allocated elsewhere (e.g. a shared memory window), which isn't freed by the pool
+ *
+ * @param pool bufferPool structure
+ * @param numBuffers number of buffers
+ * @param bufferSize size of each buffer (in bytes)
+ * @param memory numBuffers * bufferPoolStride(bufferSize) bytes, aligned to POOL_ALIGNMENT
+ */
+extern void attachBufferPool(struct bufferPool *pool, int numBuffers, size_t bufferSize, unsigned char *memory);
+
+/**
+ * @brief Acquires the next buffer of the ring
+ *
+ * @param pool bufferPool structure
+ * @return index of the buffer, -1 if all the buffers are in use
+ */
+extern int acquireBuffer(struct bufferPool *pool);
+
+/**
+ * @brief Releases the oldest buffer in use, so that it can be acquired again
+ *
+ * @param pool bufferPool structure
+ */
+extern void releaseBuffer(struct bufferPool *pool);
+
+/**
+ * @brief Get a buffer of the pool
+ *
+ * @param pool bufferPool structure
+ * @param index index of the buffer
+ * @return first byte of the buffer
+ */
+extern unsigned char *getBuffer(struct bufferPool *pool, int index);
+
+/**
+ * @brief Frees the buffers of a pool
+ *
+ * @param pool bufferPool structure
+ */
+extern void destroyBufferPool(struct bufferPool *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,385 @@
+/**
+ * @file simd.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Vectorized (SIMD) kernels of processChunk()
+ *
+ * The kernels classify 16 (SSE2) or 32 (AVX2) ASCII bytes at a time into 64-bit masks
+ * (separators, letters and each vowel) and count the words and the words with each
+ * vowel of 64 bytes at a time with bit operations:
+ * - a separator ends a word if there was a letter since the previous separator;
+ * - a word has a vowel if the vowel appears between the previous separator and the next one.
+ * Both cases are found with an addition (mask + ~separators), whose carry travels from a
+ * letter/vowel through the non-separator bytes until the next separator. The carry out of
+ * the block is the state of the word that continues in the next block.
+ *
+ * Multi-byte UTF-8 characters are classified one at a time with the scalar decoder.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "classes.h"
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Kernel used by processChunk() */
+void (*chunkKernel)(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) = processChunkScalar;
+
+
+/**
+ * @brief Get the kernel identifier from its name
+ *
+ * @param name "auto", "scalar", "sse2" or "avx2"
+ * @return KERNEL_* identifier, -1 if the name is not valid
+ */
+int parseKernelName(const char *name) {
+
+    if (strcmp(name, "auto") == 0) {
+        return KERNEL_AUTO;
+    } else if (strcmp(name, "scalar") == 0) {
+        return KERNEL_SCALAR;
+    } else if (strcmp(name, "sse2") == 0) {
+        return KERNEL_SSE2;
+    } else if (strcmp(name, "avx2") == 0) {
+        return KERNEL_AVX2;
+    }
+    return -1;
+
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/** @brief Number of classes with a bitmask (the 6 vowels, separators and apostrophes) */
+#define NUM_MASKED_CLASSES (CHAR_CLASS_APOSTROPHE + 1)
+
+/** @brief Number of bytes counted at a time (one bit of each 64-bit mask per byte) */
+#define SIMD_BLOCK_SIZE 64
+
+/** @brief ASCII bytes of each masked class, sorted by class */
+static unsigned char classBytes[128];
+
+/** @brief classBytes[classStart[c]] to classBytes[classStart[c + 1] - 1] are the bytes of class c */
+static int classStart[NUM_MASKED_CLASSES + 1];
+
+/** @brief nibbleTables[h][l] has the bit c set if the ASCII byte 0xhl is of class c (looked up with pshufb) */
+static unsigned char nibbleTables[8][16];
+
+/** @brief Class of the code points below U+0800 (every 2-byte UTF-8 character) */
+static unsigned char twoByteClass[0x800];
+
+
+/**
+ * @brief Builds the list of ASCII bytes of each class, the nibble tables and the class of
+ * the 2-byte characters from the lookup tables of getCharClass()
+ *
+ */
+static void initClassBytes() {
+
+    int count = 0;
+
+    for (int byte = 0; byte < 128; byte++) {
+        int charClass = getCharClass(byte);
+        nibbleTables[byte >> 4][byte & 0x0F] = (charClass < NUM_MASKED_CLASSES) ? (1 << charClass) : 0;
+    }
+
+    for (int c = 0; c < NUM_MASKED_CLASSES; c++) {
+        classStart[c] = count;
+        for (int byte = 0; byte < 128; byte++) {
+            if (getCharClass(byte) == c) {
+                classBytes[count++] = byte;
+            }
+        }
+    }
+    classStart[NUM_MASKED_CLASSES] = count;
+
+    for (unsigned int codePoint = 0; codePoint < 0x800; codePoint++) {
+        twoByteClass[codePoint] = getCharClass(codePoint);
+    }
+
+}
+
+
+/**
+ * @brief Adds the multi-byte characters of a block to its bitmasks. Each character is classified
+ * with the scalar decoder and marked at its first byte; its continuation bytes are neither letters
+ * nor separators
+ *
+ * @param chunk first byte of the block
+ * @param n number of bytes of the block
+ * @param nonAscii bitmask of the bytes >= 0x80 of the block
+ * @param masks bitmasks of the block, indexed by class
+ * @param letters bitmask of the letters (vowels and other characters) of the block
+ * @return number of bytes of the block that can be counted (a character may not fit in the block)
+ */
+static inline unsigned int addMultiByteChars(const unsigned char *chunk, unsigned int n, uint64_t nonAscii,
+                                             uint64_t masks[NUM_MASKED_CLASSES], uint64_t *letters) {
+
+    while (nonAscii) {
+
+        unsigned int p = __builtin_ctzll(nonAscii);
+        int byte = chunk[p];
+        int length;
+
+        if (byte >= 0xC0 && byte < 0xE0 && p + 1 < n && (chunk[p + 1] & 0xC0) == 0x80) {
+            length = 2;
+        } else {
+            length = getCharLength(chunk + p, n - p);
+        }
+
+        /* The character continues in the next block */
+        if (p + length > n) {
+            return p;
+        }
+
+        /* The continuation bytes are non-ASCII, so they're neither letters nor separators */
+        uint64_t continuation = (((uint64_t) 1 << (length - 1)) - 1) << (p + 1);
+
+        int charClass;
+        if (length == 2) {
+            charClass = twoByteClass[((byte & 0x1F) << 6) | (chunk[p + 1] & 0x3F)];
+        } else {
+            charClass = getCharClass(decodeUTF8(chunk + p, length));
+        }
+
+        if (charClass <= CHAR_CLASS_Y) {
+            masks[charClass] |= (uint64_t) 1 << p;
+            *letters |= (uint64_t) 1 << p;
+        } else if (charClass == CHAR_CLASS_OTHER) {
+            *letters |= (uint64_t) 1 << p;
+        } else {
+            masks[charClass] |= (uint64_t) 1 << p;
+        }
+
+        nonAscii &= ~(continuation | ((uint64_t) 1 << p));
+
+    }
+
+    return n;
+
+}
+
+
+/**
+ * @brief Adds two n-bit masks and a carry
+ *
+ * @param a first mask
+ * @param b second mask
+ * @param carry carry into the first bit
+ * @param n number of bits of the masks (at most 64)
+ * @param carryOut carry out of the bit n - 1
+ * @return sum of the masks
+ */
+static inline uint64_t addMasks(uint64_t a, uint64_t b, unsigned int carry, unsigned int n, unsigned int *carryOut) {
+
+    unsigned long long sum;
+    unsigned int overflow = __builtin_uaddll_overflow(a, b, &sum);
+    overflow |= __builtin_uaddll_overflow(sum, carry, &sum);
+
+    *carryOut = (n == 64) ? overflow : (sum >> n) & 1;
+    return sum;
+
+}
+
+
+/**
+ * @brief Counts the words and the words with each vowel of the first n bytes of a block
+ * from its bitmasks, carrying the state of the last word to the next block
+ *
+ * @param masks bitmasks of the block, indexed by class
+ * @param letters bitmask of the letters (vowels and other characters) of the block
+ * @param n number of bytes of the block to count (at most 64)
+ * @param state state of the word being read
+ * @param chunkData fileChunk structure with the partial results
+ */
+static inline void countBlock(const uint64_t masks[NUM_MASKED_CLASSES], uint64_t letters, unsigned int n,
+                              struct wordState *state, struct fileChunk *chunkData) {
+
+    uint64_t valid = (n == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+    uint64_t separators = masks[CHAR_CLASS_SEPARATOR] & valid;
+    uint64_t notSeparators = ~separators & valid;
+    unsigned int carryOut;
+
+    /* A separator ends a word if the carry of a letter (or of the previous block) reaches it */
+    uint64_t sum = addMasks(letters & valid, notSeparators, state->inWord, n, &carryOut);
+    chunkData->summary.numWords += __builtin_popcountll(sum & separators);
+    state->inWord = carryOut;
+
+    for (int c = CHAR_CLASS_A; c <= CHAR_CLASS_Y; c++) {
+
+        /* Words (closed in this block or continuing to the next) with the vowel, minus the word already counted (may be -1) */
+        unsigned int carry = (state->wordVowels >> c) & 1;
+        sum = addMasks(masks[c] & valid, notSeparators, carry, n, &carryOut);
+        chunkData->summary.nWordsWithVowel[c] += __builtin_popcountll(sum & separators) + (int) carryOut - (int) carry;
+        state->wordVowels = (state->wordVowels & ~(1u << c)) | (carryOut << c);
+
+    }
+
+}
+
+
+/**
+ * @brief SSE2 kernel of processChunk(), classifies 16 bytes at a time by comparing them
+ * with the ASCII bytes of each class
+ *
+ * @param chunkData
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+__attribute__((target("sse2")))
+void processChunkSSE2(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) {
+
+    __m128i classVectors[128];
+    unsigned int i = start;
+
+    for (int j = 0; j < classStart[NUM_MASKED_CLASSES]; j++) {
+        classVectors[j] = _mm_set1_epi8(classBytes[j]);
+    }
+
+    while (i + SIMD_BLOCK_SIZE <= end) {
+
+        uint64_t nonAscii = 0;
+        uint64_t masks[NUM_MASKED_CLASSES] = { 0 };
+
+        for (int k = 0; k < SIMD_BLOCK_SIZE; k += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *) (chunkData->chunk + i + k));
+            nonAscii |= (uint64_t) _mm_movemask_epi8(block) << k;
+            for (int c = 0; c < NUM_MASKED_CLASSES; c++) {
+                __m128i matches = _mm_setzero_si128();
+                for (int j = classStart[c]; j < classStart[c + 1]; j++) {
+                    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, classVectors[j]));
+                }
+                masks[c] |= (uint64_t) _mm_movemask_epi8(matches) << k;
+            }
+        }
+
+        uint64_t letters = ~(masks[CHAR_CLASS_SEPARATOR] | masks[CHAR_CLASS_APOSTROPHE] | nonAscii);
+        unsigned int n = addMultiByteChars(chunkData->chunk + i, SIMD_BLOCK_SIZE, nonAscii, masks, &letters);
+
+        if (n == 0) {
+            /* The first character of the block continues in the next block */
+            i = processBytes(chunkData, state, i, i + 1);
+            continue;
+        }
+
+        countBlock(masks, letters, n, state, chunkData);
+        i += n;
+
+    }
+
+    processBytes(chunkData, state, i, end);
+
+}
+
+
+/**
+ * @brief AVX2 kernel of processChunk(), classifies 32 bytes at a time. The class of each byte
+ * is looked up (vpshufb) in the nibble table of its high nibble
+ *
+ * @param chunkData
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+__attribute__((target("avx2,popcnt")))
+void processChunkAVX2(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) {
+
+    __m256i tables[8], highNibbles[8], classBits[NUM_MASKED_CLASSES];
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    unsigned int i = start;
+
+    for (int h = 0; h < 8; h++) {
+        tables[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) nibbleTables[h]));
+        highNibbles[h] = _mm256_set1_epi8(h);
+    }
+    for (int c = 0; c < NUM_MASKED_CLASSES; c++) {
+        classBits[c] = _mm256_set1_epi8(1 << c);
+    }
+
+    while (i + SIMD_BLOCK_SIZE <= end) {
+
+        uint64_t nonAscii = 0;
+        uint64_t masks[NUM_MASKED_CLASSES] = { 0 };
+
+        for (int k = 0; k < SIMD_BLOCK_SIZE; k += 32) {
+
+            __m256i block = _mm256_loadu_si256((const __m256i *) (chunkData->chunk + i + k));
+            nonAscii |= (uint64_t) (unsigned int) _mm256_movemask_epi8(block) << k;
+
+            /* Bytes >= 0x80 are looked up as zero by vpshufb and don't match any high nibble */
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibbleMask);
+            __m256i classes = _mm256_setzero_si256();
+            for (int h = 0; h < 8; h++) {
+                __m256i lookup = _mm256_shuffle_epi8(tables[h], block);
+                classes = _mm256_or_si256(classes, _mm256_and_si256(lookup, _mm256_cmpeq_epi8(high, highNibbles[h])));
+            }
+            for (int c = 0; c < NUM_MASKED_CLASSES; c++) {
+                __m256i matches = _mm256_cmpeq_epi8(_mm256_and_si256(classes, classBits[c]), classBits[c]);
+                masks[c] |= (uint64_t) (unsigned int) _mm256_movemask_epi8(matches) << k;
+            }
+
+        }
+
+        uint64_t letters = ~(masks[CHAR_CLASS_SEPARATOR] | masks[CHAR_CLASS_APOSTROPHE] | nonAscii);
+        unsigned int n = addMultiByteChars(chunkData->chunk + i, SIMD_BLOCK_SIZE, nonAscii, masks, &letters);
+
+        if (n == 0) {
+            /* The first character of the block continues in the next block */
+            i = processBytes(chunkData, state, i, i + 1);
+            continue;
+        }
+
+        countBlock(masks, letters, n, state, chunkData);
+        i += n;
+
+    }
+
+    processBytes(chunkData, state, i, end);
+
+}
+
+#endif
+
+
+/**
+ * @brief Chooses the kernel used by processChunk(). If the requested kernel is not supported
+ * by the CPU (or KERNEL_AUTO is requested), the best supported kernel is used
+ *
+ * @param kernel KERNEL_* identifier
+ * @return identifier of the kernel that was chosen
+ */
+int selectChunkKernel(int kernel) {
+
+    chunkKernel = processChunkScalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    if (kernel == KERNEL_SCALAR) {
+        return KERNEL_SCALAR;
+    }
+
+    initClassBytes();
+    __builtin_cpu_init();
+
+    if (kernel != KERNEL_SSE2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        chunkKernel = processChunkAVX2;
+        return KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        chunkKernel = processChunkSSE2;
+        return KERNEL_SSE2;
+    }
+
+#endif
+
+    return KERNEL_SCALAR;
+
+}
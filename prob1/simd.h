@@ -0,0 +1,60 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *  
+ *  Header file of the vectorized (SIMD) kernels of processChunk().
+ *
+ */
+
+#include "utils.h"
+
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * @brief Kernel used by processChunk() (scalar by default, set by selectChunkKernel())
+ * 
+ */
+extern void (*chunkKernel)(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
+
+/**
+ * @brief Get the kernel identifier from its name
+ * 
+ * @param name "auto", "scalar", "sse2" or "avx2"
+ * @return KERNEL_* identifier, -1 if the name is not valid
+ */
+extern int parseKernelName(const char *name);
+
+/**
+ * @brief Chooses the kernel used by processChunk(). If the requested kernel is not supported
+ * by the CPU (or KERNEL_AUTO is requested), the best supported kernel is used
+ * 
+ * @param kernel KERNEL_* identifier
+ * @return identifier of the kernel that was chosen
+ */
+extern int selectChunkKernel(int kernel);
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * @brief SSE2 kernel of processChunk(), classifies 16 bytes at a time
+ * 
+ * @param chunkData 
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+extern void processChunkSSE2(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
+
+/**
+ * @brief AVX2 kernel of processChunk(), classifies 32 bytes at a time
+ * 
+ * @param chunkData 
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+extern void processChunkAVX2(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
+
+#endif
+
+#endif /* SIMD_H */
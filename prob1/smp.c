@@ -0,0 +1,356 @@
+/**
+ * @file smp.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Single-process (shared memory) version of the text processing, without MPI
+ *
+ * Problem: Text processing in Portuguese with Multithreading
+ *
+ * The same counting engine of the MPI version (processChunk(), mergeSummaries() and getResults()) is used by the
+ * threads of a single process, so that a run on one node doesn't need an MPI runtime. The input files are memory
+ * mapped and cut into fixed-size ranges, which the threads claim through an atomic cursor (the ranges of all the
+ * files are numbered in order): a thread that is done with a range claims the next one, so a slow thread doesn't
+ * stall the others. Each range gets a summary, written only by the thread that processed it, and the summaries of
+ * each file are merged in order by the main thread once all the threads are done.
+ *
+ * Workflow:
+ *
+ * 1 - Read and process the command line arguments;
+ * 2 - Store filenames, map the files and number their ranges
+ * 3 - Start the threads, which until there are no ranges left:
+ *      3.1 - Claim the next range (atomic cursor)
+ *      3.2 - Process it (no bytes are copied) and save its summary
+ * 4 - Join the threads and merge the summaries of each file, in order
+ * 5 - Print the results of the text processing of all the input files
+ *
+ * Streams (stdin, pipes and FIFOs) and compressed files can't be mapped, so they're only read by the MPI version.
+ *
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "simd.h"
+#include "tuner.h"
+#include "classes.h"
+#include "metrics.h"
+
+/* Number of files to be processed */
+int numFiles = 0;
+
+/* Max. number of bytes of a range */
+int CHUNK_BYTE_LIMIT;
+
+/* Number of threads */
+int numThreads = 0;
+
+/* Not used by this version (the ranges aren't taken with getChunk()) */
+int currentFileIndex = 0;
+
+/* The files are always mapped */
+bool parallelIO = false;
+
+/* The words aren't counted by this version (the word map isn't shared by threads) */
+int topK = 0;
+
+/* Metrics counted in the same pass as the words (--metrics, 0 if there are none) */
+int metricsMask = 0;
+
+/* File structure declaration - will be used to store file related data (numWords, etc..) */
+extern struct fileInfo *files;
+
+/* Index of the first range of each file, by position in the schedule (and the total number of ranges, in firstRange[numFiles]) */
+static size_t *firstRange;
+
+/* Index of the next range to be claimed by a thread */
+static atomic_size_t nextRange;
+
+/* Summary of each range, set by the thread that processed it */
+static struct chunkSummary *summaries;
+
+/* Declaration of the function usage -> Usage of the program */
+void usage();
+
+/* Declaration of the function countRanges -> Thread that processes ranges until there are none left */
+void *countRanges(void *arg);
+
+/**
+ * @brief Main program
+ *
+ * 1 - Read and process the command line arguments;
+ * 2 - Store filenames, map the files and number their ranges
+ * 3 - Start the threads, which process the ranges they claim
+ * 4 - Join the threads and merge the summaries of each file, in order
+ * 5 - Print the results of the text processing of all the input files
+ *
+ * @param argc number of words of the command line
+ * @param argv list of words of the command line
+ * @return status of operation
+ */
+int main(int argc, char *argv[]) {
+
+    /* ERROR. No arguments for filenames were introduced to the program. */
+    if (argc < 2) {
+        printf("[ERROR] Invalid number of files");
+        return 1;
+    }
+
+    const char *optstr = "f:t:c:k:h";       /* Acceptable command line arguments and parsing */
+    const struct option longOptions[] = {
+        { "stats", no_argument, NULL, 'S' },
+        { "classes", required_argument, NULL, 'C' },
+        { "metrics", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 }
+    };
+    bool printStats = false;                /* Tells if the throughput statistics are printed (--stats) */
+    char *classesFile = NULL;               /* Spec file of the character classes (--classes, by default Portuguese) */
+    int kernel = KERNEL_AUTO;               /* Kernel used to process the ranges */
+    int option;                             /* Store current command line arg */
+    char **filenames = (char **) malloc(argc * sizeof(char *));    /* Declare filenames array (there are at most argc files) */
+    CHUNK_BYTE_LIMIT = 0;                   /* Size of the ranges (by default, set with the size of the input) */
+    bool autoChunkSize = true;              /* Tells if the size of the ranges is set with the size of the input */
+
+    /* Structure used to keep track of the execution time */
+    struct timespec start, finish;
+
+    /* Clock start */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    /* Process command line arguments */
+    while ((option = getopt_long(argc, argv, optstr, longOptions, NULL)) != -1) {
+        switch (option) {
+            case 'f':
+                /* Save input files names */
+                filenames[numFiles++] = optarg;
+                while (optind < argc && argv[optind][0] != '-') {
+                    if (access(argv[optind], F_OK) == 0) {
+                        // file exists
+                        filenames[numFiles++] = argv[optind];
+                    } else {
+                        // file doesn't exist, show error and exit program
+                        printf("[ERROR] %s file doesn't exist", argv[optind]);
+                        return 1;
+                    }
+                    optind++;
+                }
+                break;
+            case 'c':
+                /* Define the size of the ranges */
+                CHUNK_BYTE_LIMIT = parseChunkSize(optarg, &autoChunkSize);
+                if (CHUNK_BYTE_LIMIT < 0) {
+                    fprintf(stderr, "Invalid chunk size (must be auto or %d to %d bytes, e.g. 64k or 4M)", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                /* Define the kernel used to process the ranges */
+                kernel = parseKernelName(optarg);
+                if (kernel < 0) {
+                    fprintf(stderr, "Invalid kernel (must be auto, scalar, sse2 or avx2)");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                /* Define the number of threads */
+                numThreads = atoi(optarg);
+                if (numThreads < 1 || numThreads > MAX_NUM_THREADS) {
+                    fprintf(stderr, "Invalid number of threads (must be >= 1 and <= %d)", MAX_NUM_THREADS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                /* Print the throughput statistics */
+                printStats = true;
+                break;
+            case 'C':
+                /* Load the character classes (vowels, separators and apostrophes) from a spec file */
+                classesFile = optarg;
+                break;
+            case 'M':
+                /* Count the metrics (letters, word lengths, vowels and sentences) in the same pass as the words */
+                metricsMask = parseMetrics(optarg);
+                if (metricsMask < 0) {
+                    fprintf(stderr, "Invalid metrics (must be letters, lengths, vowels, sentences or all, separated by commas)");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                /* Program usage */
+                usage();
+                return EXIT_SUCCESS;
+            default:
+                fprintf(stderr, "Option Not Defined\n");
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (loadCharClasses(classesFile) != 0) {
+        return EXIT_FAILURE;
+    }
+    selectChunkKernel(kernel);
+    if (metricsMask != 0) {
+        initMetrics();
+    }
+
+    /* By default, one thread per online core */
+    if (numThreads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (cores < 1) ? 1 : (cores > MAX_NUM_THREADS) ? MAX_NUM_THREADS : (int) cores;
+    }
+
+    /* Allocation of memory to the fileInfo structure */
+    files = (struct fileInfo *)malloc(numFiles * sizeof(struct fileInfo));
+    /* Initialize fileInfo structure (setup and store filenames) */
+    storeFilenames(files, filenames);
+
+    /* Map the files (the ranges point to the mapped files) */
+    size_t totalBytes = 0;
+    for (int i = 0; i < numFiles; i++) {
+        mapFile(files + i);
+        if ((files + i)->isStream) {
+            fprintf(stderr, "Streams (stdin, pipes and FIFOs) and compressed files can't be mapped: %s\n", (files + i)->filename);
+            return EXIT_FAILURE;
+        }
+        totalBytes += (files + i)->fileSize;
+    }
+
+    /* By default, enough ranges for every thread to claim several of them (so the threads finish together) */
+    if (autoChunkSize) {
+        size_t rangeSize = totalBytes / ((size_t) numThreads * SMP_RANGES_PER_THREAD);
+        CHUNK_BYTE_LIMIT = (rangeSize < AUTO_MIN_CHUNK_SIZE) ? AUTO_MIN_CHUNK_SIZE :
+                           (rangeSize > AUTO_MAX_CHUNK_SIZE) ? AUTO_MAX_CHUNK_SIZE : (int) rangeSize;
+    }
+
+    /* Number the ranges of the files, largest file first (the last ranges claimed are the ones of the smallest files) */
+    scheduleFiles();
+    firstRange = (size_t *) malloc((numFiles + 1) * sizeof(size_t));
+    firstRange[0] = 0;
+    for (int i = 0; i < numFiles; i++) {
+        firstRange[i + 1] = firstRange[i] + ((files + getScheduledFile(i))->fileSize + CHUNK_BYTE_LIMIT - 1) / CHUNK_BYTE_LIMIT;
+    }
+    size_t numRanges = firstRange[numFiles];
+    summaries = (struct chunkSummary *)malloc((numRanges > 0 ? numRanges : 1) * sizeof(struct chunkSummary));
+    atomic_init(&nextRange, 0);
+
+    /* The threads are never more than the ranges */
+    int activeThreads = ((size_t) numThreads < numRanges) ? numThreads : (int) numRanges;
+    pthread_t threads[MAX_NUM_THREADS];
+    for (int i = 1; i < activeThreads; i++) {
+        if (pthread_create(&threads[i], NULL, countRanges, NULL) != 0) {
+            printf("[ERROR] Can't create thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    /* The main thread is thread 0 */
+    if (activeThreads > 0) {
+        countRanges(NULL);
+    }
+    for (int i = 1; i < activeThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Merge the summaries of the ranges of each file, in order */
+    for (int i = 0; i < numFiles; i++) {
+        struct fileInfo *file = files + getScheduledFile(i);
+        for (size_t j = firstRange[i]; j < firstRange[i + 1]; j++) {
+            mergeSummaries(&file->summary, summaries + j);
+        }
+        finishFileSummary(file);
+    }
+
+    closeFiles();
+
+    /* Clock end */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &finish);
+
+    /* Print the results of the text processing of all files */
+    getResults();
+
+    /* Calculate execution time */
+    double executionTime = (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+    printf("\eExecution time = %.6f s\n", executionTime);
+    printf("Threads = %d, range size = %d bytes%s\n", activeThreads, CHUNK_BYTE_LIMIT, autoChunkSize ? " (auto)" : "");
+
+    /* Throughput statistics (the same keys as the MPI version, for the ones that apply) */
+    if (printStats) {
+        printf("STATS bytes=%zu chunks=%zu seconds=%.6f mb_per_s=%.3f chunks_per_s=%.3f\n",
+               totalBytes, numRanges, executionTime, totalBytes / executionTime / 1000000.0, numRanges / executionTime);
+    }
+
+    free(summaries);
+    free(firstRange);
+    free(files);
+    free(filenames);
+
+    return EXIT_SUCCESS;
+
+}
+
+/**
+ * @brief Thread that claims ranges (through the atomic cursor) and processes them until there are none left.
+ * The summary of a range is only written by the thread that claimed it, so no lock is needed
+ *
+ * @param arg not used
+ * @return NULL
+ */
+void *countRanges(void *arg) {
+
+    (void) arg;
+    struct fileChunk chunkData;
+    size_t numRanges = firstRange[numFiles];
+    int position = 0;
+
+    while (true) {
+
+        /* Claim the next range (in order, so a thread usually stays in the same file) */
+        size_t range = atomic_fetch_add_explicit(&nextRange, 1, memory_order_relaxed);
+        if (range >= numRanges) {
+            break;
+        }
+        while (range >= firstRange[position + 1]) {
+            position++;
+        }
+
+        int fileIndex = getScheduledFile(position);
+        struct fileInfo *file = files + fileIndex;
+        resetChunkData(&chunkData);
+        chunkData.fileIndex = fileIndex;
+        chunkData.chunkIndex = (unsigned int) range;
+        chunkData.offset = (range - firstRange[position]) * CHUNK_BYTE_LIMIT;
+        chunkData.chunk = file->data + chunkData.offset;
+        chunkData.chunkSize = (file->fileSize - chunkData.offset < (size_t) CHUNK_BYTE_LIMIT) ?
+                              (unsigned int) (file->fileSize - chunkData.offset) : (unsigned int) CHUNK_BYTE_LIMIT;
+
+        processChunk(&chunkData);
+        summaries[range] = chunkData.summary;
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * @brief prints the usage of the program
+ *
+ */
+void usage() {
+    printf("Usage:\n\t./smp -t <num_threads> -f <file1> <file2> ... <fileN> -c <chunk_size> -k <kernel> --stats --classes <file> --metrics <list>\n\n");
+    printf("\t-f <file1> <file2> ... <fileN> : List of files to be processed (regular files, they're memory mapped)\n");
+    printf("\t-t <num_threads> : Number of threads (1-%d, by default one per online core)\n", MAX_NUM_THREADS);
+    printf("\t-c <chunk_size> : Size of the ranges claimed by the threads (%d to %d, e.g. 64k or 4M), or auto (the default, about %d ranges per thread)\n", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE, SMP_RANGES_PER_THREAD);
+    printf("\t-k <kernel> : Kernel used to process the ranges (auto, scalar, sse2 or avx2)\n");
+    printf("\t--stats : Print the throughput statistics (bytes, ranges, MB/s and ranges/s)\n");
+    printf("\t--classes <file> : Spec file of the character classes (vowels, separators and apostrophes, by default the Portuguese ones)\n");
+    printf("\t--metrics <list> : Count, in the same pass as the words, the metrics of the list (letters, lengths, vowels, sentences or all, separated by commas)\n");
+}
@@ -0,0 +1,283 @@
+/**
+ * @file kernels.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Equivalence test of the kernels of processChunk() (scalar, SSE2 and AVX2)
+ *
+ * Each file is cut into chunks of several sizes (which cut words and UTF-8 sequences anywhere), and each chunk
+ * is processed with every kernel supported by the CPU. The summary of each chunk must be the same with every
+ * kernel, and the summaries of the chunks, merged in order, must give the same results as the whole file.
+ *
+ * Usage (from prob1):
+ *
+ *      gcc -Wall -O3 -o tests/kernels tests/kernels.c utils.c simd.c tuner.c classes.c words.c decompress.c metrics.c -lz
+ *      ./tests/kernels text0.txt text1.txt text2.txt text3.txt text4.txt
+ *
+ * The exit status is 0 if all the summaries are the same, 1 otherwise.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../constants.h"
+#include "../utils.h"
+#include "../simd.h"
+#include "../classes.h"
+
+/* Number of files to be processed */
+int numFiles = 0;
+
+/* Max. number of bytes of a chunk */
+int CHUNK_BYTE_LIMIT = 0;
+
+/* Not used by the test (the chunks are processed by the main thread) */
+int numThreads = 1;
+
+/* Not used by the test (the chunks aren't taken with getChunk()) */
+int currentFileIndex = 0;
+
+/* The chunks are always in memory */
+bool parallelIO = false;
+
+/* The words aren't counted by the test */
+int topK = 0;
+
+/* Only the kernels are tested (no metrics) */
+int metricsMask = 0;
+
+/**
+ * Sizes of the chunks the files are cut into (0 - the whole file). A chunk has at least the bytes of the longest
+ * UTF-8 sequence, so that it can't be only the middle of a character (the chunks of the program are much larger)
+ */
+static const unsigned int chunkSizes[] = { 4, 5, 7, 64, 1000, 1024, 4096, 65536, 0 };
+
+/* Kernels compared with the scalar kernel */
+static const int kernels[] = { KERNEL_SSE2, KERNEL_AVX2 };
+
+/* Declaration of the function readFile -> Reads a whole file into memory */
+unsigned char *readFile(const char *filename, size_t *size);
+
+/* Declaration of the function summarize -> Summary of a range of bytes, processed with the selected kernel */
+void summarize(unsigned char *bytes, unsigned int size, struct chunkSummary *summary);
+
+/* Declaration of the function sameSummaries -> Tells if two summaries have the same results */
+bool sameSummaries(const struct chunkSummary *a, const struct chunkSummary *b);
+
+/* Declaration of the function printSummary -> Prints the results of a summary (of a failed comparison) */
+void printSummary(const char *label, const struct chunkSummary *summary);
+
+
+/**
+ * @brief Main program
+ *
+ * 1 - Load the default (Portuguese) character classes
+ * 2 - For each file and chunk size, process each chunk with the scalar kernel and with each SIMD kernel
+ *     supported by the CPU, and compare their summaries
+ * 3 - Compare the merged summaries of the chunks with the summary of the whole file
+ *
+ * @param argc number of words of the command line
+ * @param argv files to be tested
+ * @return status of operation
+ */
+int main(int argc, char *argv[]) {
+
+    /* ERROR. No files to be tested. */
+    if (argc < 2) {
+        fprintf(stderr, "[ERROR] Usage: %s <file> [<file> ...]\n", argv[0]);
+        return 1;
+    }
+
+    if (loadCharClasses(NULL) != 0) {
+        fprintf(stderr, "[ERROR] Can't load the default character classes\n");
+        return 1;
+    }
+
+    int failures = 0;
+
+    for (int f = 1; f < argc; f++) {
+
+        size_t fileSize;
+        unsigned char *bytes = readFile(argv[f], &fileSize);
+        if (bytes == NULL) {
+            return 1;
+        }
+
+        /* Results of the whole file, with the scalar kernel */
+        struct chunkSummary whole;
+        selectChunkKernel(KERNEL_SCALAR);
+        summarize(bytes, fileSize, &whole);
+
+        for (size_t s = 0; s < sizeof(chunkSizes) / sizeof(chunkSizes[0]); s++) {
+
+            unsigned int chunkSize = (chunkSizes[s] == 0 || chunkSizes[s] > fileSize) ? fileSize : chunkSizes[s];
+            struct chunkSummary merged[3];
+            memset(merged, 0, sizeof(merged));
+
+            for (size_t offset = 0; offset < fileSize; offset += chunkSize) {
+
+                unsigned int size = (fileSize - offset < chunkSize) ? fileSize - offset : chunkSize;
+                struct chunkSummary scalar;
+                selectChunkKernel(KERNEL_SCALAR);
+                summarize(bytes + offset, size, &scalar);
+                mergeSummaries(&merged[0], &scalar);
+
+                for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+
+                    /* The kernel isn't supported by the CPU (another one was selected) */
+                    if (selectChunkKernel(kernels[k]) != kernels[k]) {
+                        continue;
+                    }
+
+                    struct chunkSummary simd;
+                    summarize(bytes + offset, size, &simd);
+                    mergeSummaries(&merged[k + 1], &simd);
+
+                    if (!sameSummaries(&scalar, &simd)) {
+                        printf("[FAIL] %s: chunk of %u bytes at offset %zu (kernel %d)\n", argv[f], size, offset, kernels[k]);
+                        printSummary("scalar", &scalar);
+                        printSummary("simd", &simd);
+                        failures++;
+                    }
+                }
+            }
+
+            /* The merged summaries must have the results of the whole file */
+            for (size_t k = 0; k < 3; k++) {
+                if (k > 0 && selectChunkKernel(kernels[k - 1]) != kernels[k - 1]) {
+                    continue;
+                }
+                if (!sameSummaries(&whole, &merged[k])) {
+                    printf("[FAIL] %s: merged chunks of %u bytes (kernel %d)\n", argv[f], chunkSize, (k == 0) ? KERNEL_SCALAR : kernels[k - 1]);
+                    printSummary("whole", &whole);
+                    printSummary("merged", &merged[k]);
+                    failures++;
+                }
+            }
+        }
+
+        printf("%s: %zu bytes, %" PRIu64 " words\n", argv[f], fileSize, whole.numWords);
+        free(bytes);
+    }
+
+    if (failures > 0) {
+        printf("%d comparisons failed\n", failures);
+        return 1;
+    }
+
+    printf("All the kernels have the same results\n");
+    return 0;
+
+}
+
+
+/**
+ * @brief Reads a whole file into memory
+ *
+ * @param filename name of the file
+ * @param size size of the file (set)
+ * @return bytes of the file, NULL if it can't be read
+ */
+unsigned char *readFile(const char *filename, size_t *size) {
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR] Can't open %s\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    unsigned char *bytes = (unsigned char *) malloc(*size + 1);
+    if (bytes == NULL || fread(bytes, 1, *size, file) != *size) {
+        fprintf(stderr, "[ERROR] Can't read %s\n", filename);
+        free(bytes);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return bytes;
+
+}
+
+
+/**
+ * @brief Summary of a range of bytes, processed with the kernel selected by selectChunkKernel(). The bytes are
+ * copied to a buffer of their size, so that a kernel that reads past the end of the range is caught by a
+ * memory checker
+ *
+ * @param bytes first byte of the range
+ * @param size number of bytes of the range
+ * @param summary summary of the range (set)
+ */
+void summarize(unsigned char *bytes, unsigned int size, struct chunkSummary *summary) {
+
+    struct fileChunk chunkData;
+    memset(&chunkData, 0, sizeof(struct fileChunk));
+    chunkData.chunk = (unsigned char *) malloc(size);
+    memcpy(chunkData.chunk, bytes, size);
+    chunkData.chunkSize = size;
+
+    processChunk(&chunkData);
+
+    *summary = chunkData.summary;
+    free(chunkData.chunk);
+
+}
+
+
+/**
+ * @brief Tells if two summaries have the same results: the counters, the words cut by the ends of the range and
+ * the bytes of the UTF-8 sequences cut by them
+ *
+ * @param a first summary
+ * @param b second summary
+ * @return true if the summaries are the same
+ */
+bool sameSummaries(const struct chunkSummary *a, const struct chunkSummary *b) {
+
+    if (a->numWords != b->numWords || a->hasSeparator != b->hasSeparator) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        if (a->nWordsWithVowel[i] != b->nWordsWithVowel[i]) {
+            return false;
+        }
+    }
+    if (a->lead.inWord != b->lead.inWord || a->lead.wordVowels != b->lead.wordVowels ||
+        a->trail.inWord != b->trail.inWord || a->trail.wordVowels != b->trail.wordVowels) {
+        return false;
+    }
+    if (a->headSize != b->headSize || a->tailSize != b->tailSize ||
+        memcmp(a->head, b->head, a->headSize) != 0 || memcmp(a->tail, b->tail, a->tailSize) != 0) {
+        return false;
+    }
+
+    return true;
+
+}
+
+
+/**
+ * @brief Prints the results of a summary (of a failed comparison)
+ *
+ * @param label name of the summary
+ * @param summary summary to be printed
+ */
+void printSummary(const char *label, const struct chunkSummary *summary) {
+
+    printf("  %-6s words=%" PRIu64 " vowels=", label, summary->numWords);
+    for (int i = 0; i < 6; i++) {
+        printf("%" PRIu64 "%s", summary->nWordsWithVowel[i], (i < 5) ? "," : "");
+    }
+    printf(" separator=%d lead=%d/%#x trail=%d/%#x head=%u tail=%u\n", summary->hasSeparator,
+           summary->lead.inWord, summary->lead.wordVowels, summary->trail.inWord, summary->trail.wordVowels,
+           summary->headSize, summary->tailSize);
+
+}
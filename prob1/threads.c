@@ -0,0 +1,213 @@
+/**
+ * @file threads.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Thread pool that processes the chunks received by a worker
+ *
+ * The chunks of a batch are split into ranges (units) that are processed by the threads of the pool,
+ * so that a worker can use all the cores of its node. The threads don't call MPI (MPI_THREAD_FUNNELED):
+ * the calling thread processes the units of thread 0 and two barriers mark the start and the end of each batch.
+ * Since a summary can be computed for any range of bytes, the units are cut without inspecting the chunk.
+ *
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "threads.h"
+
+/* Number of threads */
+extern int numThreads;
+
+/**
+ * @brief Range of a chunk processed by one of the threads
+ *
+ */
+struct workUnit {
+    struct fileChunk *chunkData;
+    unsigned int start;
+    unsigned int end;
+    struct chunkSummary summary;
+};
+
+/* Threads of the pool (thread 0 is the one that calls processChunks()) */
+static pthread_t threads[MAX_NUM_THREADS];
+
+/* Barriers that start and end the processing of a batch */
+static pthread_barrier_t startBarrier, endBarrier;
+
+/* Units of the current batch */
+static struct workUnit *units = NULL;
+static int numUnits = 0;
+
+/* Tells the threads of the pool to exit */
+static bool stopThreads = false;
+
+
+/**
+ * @brief Processes the units of a thread (units thread, thread + numThreads, ...)
+ *
+ * @param thread index of the thread
+ */
+static void processUnits(int thread) {
+
+    for (int u = thread; u < numUnits; u += numThreads) {
+
+        struct workUnit *unit = units + u;
+        struct fileChunk part;
+
+        memset(&part, 0, sizeof(struct fileChunk));
+        part.chunk = unit->chunkData->chunk + unit->start;
+        part.chunkSize = unit->end - unit->start;
+        processChunk(&part);
+        unit->summary = part.summary;
+
+    }
+
+}
+
+
+/**
+ * @brief Life cycle of a thread of the pool: wait for a batch, process its units and wait for the other threads
+ *
+ * @param arg index of the thread
+ * @return NULL
+ */
+static void *threadMain(void *arg) {
+
+    int thread = (int) (intptr_t) arg;
+
+    while (true) {
+
+        pthread_barrier_wait(&startBarrier);
+        if (stopThreads) {
+            break;
+        }
+        processUnits(thread);
+        pthread_barrier_wait(&endBarrier);
+
+    }
+
+    return NULL;
+
+}
+
+
+/**
+ * @brief Starts the numThreads - 1 threads of the pool (the calling thread is the other one),
+ * which wait for the chunks given to processChunks()
+ *
+ * @param maxChunks maximum number of chunks processed at a time
+ */
+void startThreadPool(int maxChunks) {
+
+    /* Each chunk has at most one unit more than its share of the batch */
+    units = (struct workUnit *) malloc((numThreads + maxChunks) * sizeof(struct workUnit));
+    if (units == NULL) {
+        printf("[ERROR] Can't allocate memory for the thread pool\n");
+        exit(1);
+    }
+
+    if (numThreads == 1) {
+        return;
+    }
+
+    pthread_barrier_init(&startBarrier, NULL, numThreads);
+    pthread_barrier_init(&endBarrier, NULL, numThreads);
+
+    for (int i = 1; i < numThreads; i++) {
+        if (pthread_create(&threads[i], NULL, threadMain, (void *) (intptr_t) i) != 0) {
+            printf("[ERROR] Can't create thread %d\n", i);
+            exit(1);
+        }
+    }
+
+}
+
+
+/**
+ * @brief Processes a batch of chunks with the threads of the pool. The chunks are split into ranges of
+ * at least MIN_BYTES_PER_THREAD bytes (about the same number of bytes per thread), whose summaries are
+ * merged in order into the summary of their chunk. Returns when all the chunks were processed
+ *
+ * @param chunks fileChunk structures of the chunks
+ * @param numChunks number of chunks
+ */
+void processChunks(struct fileChunk **chunks, int numChunks) {
+
+    size_t totalBytes = 0;
+    unsigned int unitSize;
+
+    for (int i = 0; i < numChunks; i++) {
+        totalBytes += chunks[i]->chunkSize;
+    }
+    unitSize = (totalBytes + numThreads - 1) / numThreads;
+    if (unitSize < MIN_BYTES_PER_THREAD) {
+        unitSize = MIN_BYTES_PER_THREAD;
+    }
+
+    /* Split the chunks (the last unit of a chunk takes the remaining bytes if they're too few) */
+    numUnits = 0;
+    for (int i = 0; i < numChunks; i++) {
+        unsigned int size = chunks[i]->chunkSize;
+        for (unsigned int start = 0; start < size; ) {
+            unsigned int end = (size - start > unitSize) ? start + unitSize : size;
+            if (size - end < MIN_BYTES_PER_THREAD) {
+                end = size;
+            }
+            units[numUnits].chunkData = chunks[i];
+            units[numUnits].start = start;
+            units[numUnits].end = end;
+            numUnits++;
+            start = end;
+        }
+    }
+
+    if (numThreads == 1) {
+        processUnits(0);
+    } else {
+        pthread_barrier_wait(&startBarrier);
+        processUnits(0);
+        pthread_barrier_wait(&endBarrier);
+    }
+
+    /* Merge the units of each chunk in order */
+    for (int u = 0; u < numUnits; u++) {
+        struct fileChunk *chunkData = units[u].chunkData;
+        if (units[u].start == 0) {
+            chunkData->summary = units[u].summary;
+        } else {
+            mergeSummaries(&chunkData->summary, &units[u].summary);
+        }
+    }
+
+}
+
+
+/**
+ * @brief Stops and joins the threads of the pool
+ *
+ */
+void stopThreadPool() {
+
+    if (numThreads > 1) {
+
+        stopThreads = true;
+        pthread_barrier_wait(&startBarrier);
+        for (int i = 1; i < numThreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_barrier_destroy(&startBarrier);
+        pthread_barrier_destroy(&endBarrier);
+
+    }
+
+    free(units);
+    units = NULL;
+
+}
@@ -0,0 +1,37 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the thread pool that processes the chunks received by a worker.
+ *
+ */
+
+#include "utils.h"
+
+#ifndef THREADS_H
+#define THREADS_H
+
+/**
+ * @brief Starts the numThreads - 1 threads of the pool (the calling thread is the other one),
+ * which wait for the chunks given to processChunks()
+ *
+ * @param maxChunks maximum number of chunks processed at a time
+ */
+extern void startThreadPool(int maxChunks);
+
+/**
+ * @brief Processes a batch of chunks with the threads of the pool. The chunks are split into ranges of
+ * at least MIN_BYTES_PER_THREAD bytes (about the same number of bytes per thread), whose summaries are
+ * merged in order into the summary of their chunk. Returns when all the chunks were processed
+ *
+ * @param chunks fileChunk structures of the chunks
+ * @param numChunks number of chunks
+ */
+extern void processChunks(struct fileChunk **chunks, int numChunks);
+
+/**
+ * @brief Stops and joins the threads of the pool
+ *
+ */
+extern void stopThreadPool();
+
+#endif /* THREADS_H */
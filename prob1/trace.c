@@ -0,0 +1,208 @@
+/**
+ * @file trace.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Timeline instrumentation (--trace), exported as Chrome trace events
+ *
+ * Each rank records its spans (phase, start and end) in a local buffer, which grows as needed, so that
+ * recording a span is only a clock read and a store. At the end, the spans are gathered into rank 0,
+ * which writes them in the trace event format of chrome://tracing and Perfetto (one track per rank)
+ * and prints the time spent on each phase by each rank.
+ *
+ */
+
+#include <mpi.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "trace.h"
+
+/**
+ * @brief Span of the timeline of a rank (times in seconds since the start of the timeline)
+ *
+ */
+struct traceSpan {
+    double start;
+    double end;
+    int phase;
+    int chunkIndex;
+};
+
+/* Names of the phases (indexed by TRACE_*) */
+static const char *phaseNames[TRACE_NUM_PHASES] = { "read", "send", "wait", "merge", "process", "send results" };
+
+/* Tells if the spans are recorded */
+static bool tracing = false;
+
+/* Start of the timeline of this rank (after a barrier, so that the timelines of the ranks are aligned) */
+static double traceStart = 0;
+
+/* Spans recorded by this rank */
+static struct traceSpan *spans = NULL;
+static int numSpans = 0;
+static int spansCapacity = 0;
+
+
+/**
+ * @brief Enables (or not) the instrumentation and sets the start of the timeline of this rank.
+ * Called by all the ranks, after the options are broadcasted
+ *
+ * @param enabled tells if the spans are recorded
+ */
+void initTrace(bool enabled) {
+
+    tracing = enabled;
+    if (tracing) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        traceStart = MPI_Wtime();
+    }
+
+}
+
+
+/**
+ * @brief Get the start time of a span
+ *
+ * @return current time (in seconds), 0 if the instrumentation is disabled
+ */
+double traceTime() {
+
+    return tracing ? MPI_Wtime() : 0;
+
+}
+
+
+/**
+ * @brief Records a span, from its start time until now
+ *
+ * @param phase TRACE_* phase of the span
+ * @param start start time of the span (returned by traceTime())
+ * @param chunkIndex index of the chunk of the span (-1 if it has none)
+ */
+void traceSpan(int phase, double start, int chunkIndex) {
+
+    if (!tracing) {
+        return;
+    }
+
+    if (numSpans == spansCapacity) {
+        spansCapacity = (spansCapacity == 0) ? 4096 : 2 * spansCapacity;
+        spans = (struct traceSpan *) realloc(spans, spansCapacity * sizeof(struct traceSpan));
+        if (spans == NULL) {
+            printf("[ERROR] Can't allocate memory for the trace\n");
+            exit(1);
+        }
+    }
+
+    spans[numSpans].start = start - traceStart;
+    spans[numSpans].end = MPI_Wtime() - traceStart;
+    spans[numSpans].phase = phase;
+    spans[numSpans].chunkIndex = chunkIndex;
+    numSpans++;
+
+}
+
+
+/**
+ * @brief Gathers the spans of all the ranks into rank 0, which writes them as Chrome/Perfetto trace events
+ * and prints the time spent on each phase by each rank. Called by all the ranks
+ *
+ * @param filename name of the trace file (only used by rank 0)
+ * @param isNodeDispatcher tells if the rank is a node dispatcher (--node-ranks), so that its track is labeled as one
+ */
+void writeTrace(const char *filename, bool isNodeDispatcher) {
+
+    int rank, size;
+    MPI_Datatype spanType;
+    int *counts = NULL, *displacements = NULL, *roles = NULL;
+    int role = isNodeDispatcher;
+    struct traceSpan *allSpans = NULL;
+
+    if (!tracing) {
+        return;
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    /* The spans are sent as raw bytes (all the ranks have the same architecture) */
+    MPI_Type_contiguous(sizeof(struct traceSpan), MPI_BYTE, &spanType);
+    MPI_Type_commit(&spanType);
+
+    if (rank == 0) {
+        counts = (int *) malloc(size * sizeof(int));
+        displacements = (int *) malloc(size * sizeof(int));
+        roles = (int *) malloc(size * sizeof(int));
+    }
+    MPI_Gather(&numSpans, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gather(&role, 1, MPI_INT, roles, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    int totalSpans = 0;
+    if (rank == 0) {
+        for (int i = 0; i < size; i++) {
+            displacements[i] = totalSpans;
+            totalSpans += counts[i];
+        }
+        allSpans = (struct traceSpan *) malloc((totalSpans + 1) * sizeof(struct traceSpan));
+        if (allSpans == NULL) {
+            printf("[ERROR] Can't allocate memory for the trace\n");
+            exit(1);
+        }
+    }
+    MPI_Gatherv(spans, numSpans, spanType, allSpans, counts, displacements, spanType, 0, MPI_COMM_WORLD);
+    MPI_Type_free(&spanType);
+
+    free(spans);
+    spans = NULL;
+    numSpans = spansCapacity = 0;
+
+    if (rank != 0) {
+        return;
+    }
+
+    /* Trace events: a track (thread) per rank, named by its role, and a complete event ("X", in microseconds) per span */
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("[ERROR] Can't create file %s\n", filename);
+    } else {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (int r = 0; r < size; r++) {
+            fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}},\n",
+                    r, (r == 0) ? "dispatcher" : (roles[r] ? "node dispatcher" : "worker"), r);
+        }
+        for (int r = 0; r < size; r++) {
+            for (int i = displacements[r]; i < displacements[r] + counts[r]; i++) {
+                struct traceSpan *span = allSpans + i;
+                fprintf(file, "{\"name\":\"%s\",\"cat\":\"prob1\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"chunk\":%d}},\n",
+                        phaseNames[span->phase], r, span->start * 1e6, (span->end - span->start) * 1e6, span->chunkIndex);
+            }
+        }
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"prob1\"}}\n]}\n");
+        fclose(file);
+    }
+
+    /* Time spent on each phase by each rank */
+    printf("\nTime per phase (s)\n%-10s", "Rank");
+    for (int p = 0; p < TRACE_NUM_PHASES; p++) {
+        printf(" %13s", phaseNames[p]);
+    }
+    printf("\n");
+    for (int r = 0; r < size; r++) {
+        double phaseTime[TRACE_NUM_PHASES] = { 0 };
+        for (int i = displacements[r]; i < displacements[r] + counts[r]; i++) {
+            phaseTime[allSpans[i].phase] += allSpans[i].end - allSpans[i].start;
+        }
+        printf("%-10d", r);
+        for (int p = 0; p < TRACE_NUM_PHASES; p++) {
+            printf(" %13.6f", phaseTime[p]);
+        }
+        printf("\n");
+    }
+
+    free(counts);
+    free(displacements);
+    free(roles);
+    free(allSpans);
+
+}
@@ -0,0 +1,46 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the timeline instrumentation (--trace), exported as Chrome trace events.
+ *
+ */
+
+#include <stdbool.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * @brief Enables (or not) the instrumentation and sets the start of the timeline of this rank.
+ * Called by all the ranks, after the options are broadcasted
+ *
+ * @param enabled tells if the spans are recorded
+ */
+extern void initTrace(bool enabled);
+
+/**
+ * @brief Get the start time of a span
+ *
+ * @return current time (in seconds), 0 if the instrumentation is disabled
+ */
+extern double traceTime();
+
+/**
+ * @brief Records a span, from its start time until now
+ *
+ * @param phase TRACE_* phase of the span
+ * @param start start time of the span (returned by traceTime())
+ * @param chunkIndex index of the chunk of the span (-1 if it has none)
+ */
+extern void traceSpan(int phase, double start, int chunkIndex);
+
+/**
+ * @brief Gathers the spans of all the ranks into rank 0, which writes them as Chrome/Perfetto trace events
+ * and prints the time spent on each phase by each rank. Called by all the ranks
+ *
+ * @param filename name of the trace file (only used by rank 0)
+ * @param isNodeDispatcher tells if the rank is a node dispatcher (--node-ranks), so that its track is labeled as one
+ */
+extern void writeTrace(const char *filename, bool isNodeDispatcher);
+
+#endif /* TRACE_H */
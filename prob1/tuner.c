@@ -0,0 +1,176 @@
+/**
+ * @file tuner.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Chunk size tuning of the dispatcher
+ *
+ * Small chunks are dominated by the latency of their messages, large chunks leave the workers idle at the
+ * end of the input. In auto mode the dispatcher sizes each chunk from the processing rate and the waiting
+ * time measured by the workers (reported with the results of each chunk), and shrinks the chunks as the
+ * input runs out (guided self-scheduling).
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "tuner.h"
+
+
+/**
+ * @brief Get the chunk size from its command line value
+ *
+ * @param text "auto" or a number of bytes, optionally followed by k or M (e.g. 64k, 4M)
+ * @param isAuto set to true if the chunk size is "auto"
+ * @return chunk size (in bytes), 0 if it's "auto", -1 if it's not valid
+ */
+long parseChunkSize(const char *text, bool *isAuto) {
+
+    char *end;
+    long size;
+    long multiplier = 1;
+
+    *isAuto = (strcmp(text, "auto") == 0);
+    if (*isAuto) {
+        return 0;
+    }
+
+    errno = 0;
+    size = strtol(text, &end, 10);
+    if (end == text || errno == ERANGE || size < 0) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        multiplier = 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        multiplier = 1024 * 1024;
+        end++;
+    }
+
+    /* The size is checked before it's multiplied, so that a huge number can't overflow into the valid sizes */
+    if (*end != '\0' || size > MAX_CHUNK_SIZE / multiplier) {
+        return -1;
+    }
+    size *= multiplier;
+    if (size < MIN_CHUNK_SIZE) {
+        return -1;
+    }
+
+    return size;
+
+}
+
+
+/**
+ * @brief Initializes the tuning state
+ *
+ * @param tuner chunkTuner structure
+ * @param isAuto tells if the chunk size is tuned (otherwise every chunk has maxChunkSize bytes)
+ * @param maxChunkSize chunk size (fixed) or largest chunk size (auto)
+ * @param totalBytes size of all the files
+ * @param numWorkers number of workers
+ */
+void initChunkTuner(struct chunkTuner *tuner, bool isAuto, unsigned int maxChunkSize, size_t totalBytes, int numWorkers) {
+
+    tuner->isAuto = isAuto;
+    tuner->maxChunkSize = maxChunkSize;
+    tuner->numWorkers = numWorkers;
+    tuner->processingRate = 0;
+    tuner->waitingTime = 0;
+    tuner->bytesLeft = totalBytes;
+    tuner->minSent = 0;
+    tuner->maxSent = 0;
+
+}
+
+
+/**
+ * @brief Get the size of the next chunk. In auto mode a chunk should take AUTO_TARGET_CHUNK_TIME to be processed
+ * (longer if the workers wait too long for their chunks), and near the end of the input each worker gets a
+ * fraction of the bytes left, so that the last chunks are spread over all the workers
+ *
+ * @param tuner chunkTuner structure
+ * @return size of the next chunk (in bytes)
+ */
+unsigned int nextChunkSize(struct chunkTuner *tuner) {
+
+    if (!tuner->isAuto) {
+        return tuner->maxChunkSize;
+    }
+
+    double chunkSize = AUTO_INITIAL_CHUNK_SIZE;
+
+    /* Processing time of a chunk, at least AUTO_WAIT_RATIO times the time a worker waits for it */
+    if (tuner->processingRate > 0) {
+        double targetTime = AUTO_TARGET_CHUNK_TIME;
+        if (tuner->waitingTime * AUTO_WAIT_RATIO > targetTime) {
+            targetTime = tuner->waitingTime * AUTO_WAIT_RATIO;
+        }
+        chunkSize = tuner->processingRate * targetTime;
+    }
+
+    /* Near the end of the input, a chunk is only a fraction of each worker's share of the bytes left */
+    double share = (double) tuner->bytesLeft / (AUTO_TAIL_FACTOR * tuner->numWorkers);
+    if (chunkSize > share) {
+        chunkSize = share;
+    }
+
+    if (chunkSize < AUTO_MIN_CHUNK_SIZE) {
+        chunkSize = AUTO_MIN_CHUNK_SIZE;
+    }
+    if (chunkSize > tuner->maxChunkSize) {
+        chunkSize = tuner->maxChunkSize;
+    }
+
+    return (unsigned int) chunkSize;
+
+}
+
+
+/**
+ * @brief Registers a chunk sent to a worker
+ *
+ * @param tuner chunkTuner structure
+ * @param chunkSize size of the chunk (in bytes)
+ */
+void chunkSent(struct chunkTuner *tuner, unsigned int chunkSize) {
+
+    tuner->bytesLeft = (chunkSize < tuner->bytesLeft) ? tuner->bytesLeft - chunkSize : 0;
+
+    if (tuner->minSent == 0 || chunkSize < tuner->minSent) {
+        tuner->minSent = chunkSize;
+    }
+    if (chunkSize > tuner->maxSent) {
+        tuner->maxSent = chunkSize;
+    }
+
+}
+
+
+/**
+ * @brief Updates the processing rate and the waiting time of the workers with the times measured by a worker
+ *
+ * @param tuner chunkTuner structure
+ * @param chunkSize size of the chunk (in bytes)
+ * @param processingTime time the worker took to process the chunk (in seconds)
+ * @param waitingTime time the worker waited for the chunk (in seconds)
+ */
+void chunkProcessed(struct chunkTuner *tuner, unsigned int chunkSize, double processingTime, double waitingTime) {
+
+    if (processingTime <= 0) {
+        return;
+    }
+
+    /* Moving averages (the first chunk sets the processing rate) */
+    double rate = chunkSize / processingTime;
+    if (tuner->processingRate == 0) {
+        tuner->processingRate = rate;
+    } else {
+        tuner->processingRate += AUTO_SMOOTHING * (rate - tuner->processingRate);
+    }
+    tuner->waitingTime += AUTO_SMOOTHING * (waitingTime - tuner->waitingTime);
+
+}
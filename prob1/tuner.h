@@ -0,0 +1,78 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the chunk size tuning of the dispatcher.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef TUNER_H
+#define TUNER_H
+
+/**
+ * @brief State of the chunk size tuning. With a fixed chunk size (-c <bytes>) every chunk has maxChunkSize bytes,
+ * in auto mode (-c auto) the size follows the measured processing rate of the workers
+ *
+ */
+struct chunkTuner {
+    bool isAuto;
+    unsigned int maxChunkSize;  /* Chunk size (fixed) or largest chunk size (auto) */
+    int numWorkers;
+    double processingRate;      /* Bytes processed per second by a worker (moving average, 0 before the first chunk) */
+    double waitingTime;         /* Time a worker waits for each chunk (moving average) */
+    size_t bytesLeft;           /* Bytes of the files that weren't sent yet */
+    unsigned int minSent;       /* Smallest and largest chunks sent */
+    unsigned int maxSent;
+};
+
+/**
+ * @brief Get the chunk size from its command line value
+ *
+ * @param text "auto" or a number of bytes, optionally followed by k or M (e.g. 64k, 4M)
+ * @param isAuto set to true if the chunk size is "auto"
+ * @return chunk size (in bytes), 0 if it's "auto", -1 if it's not valid
+ */
+extern long parseChunkSize(const char *text, bool *isAuto);
+
+/**
+ * @brief Initializes the tuning state
+ *
+ * @param tuner chunkTuner structure
+ * @param isAuto tells if the chunk size is tuned (otherwise every chunk has maxChunkSize bytes)
+ * @param maxChunkSize chunk size (fixed) or largest chunk size (auto)
+ * @param totalBytes size of all the files
+ * @param numWorkers number of workers
+ */
+extern void initChunkTuner(struct chunkTuner *tuner, bool isAuto, unsigned int maxChunkSize, size_t totalBytes, int numWorkers);
+
+/**
+ * @brief Get the size of the next chunk. In auto mode a chunk should take AUTO_TARGET_CHUNK_TIME to be processed
+ * (longer if the workers wait too long for their chunks), and near the end of the input each worker gets a
+ * fraction of the bytes left, so that the last chunks are spread over all the workers
+ *
+ * @param tuner chunkTuner structure
+ * @return size of the next chunk (in bytes)
+ */
+extern unsigned int nextChunkSize(struct chunkTuner *tuner);
+
+/**
+ * @brief Registers a chunk sent to a worker
+ *
+ * @param tuner chunkTuner structure
+ * @param chunkSize size of the chunk (in bytes)
+ */
+extern void chunkSent(struct chunkTuner *tuner, unsigned int chunkSize);
+
+/**
+ * @brief Updates the processing rate and the waiting time of the workers with the times measured by a worker
+ *
+ * @param tuner chunkTuner structure
+ * @param chunkSize size of the chunk (in bytes)
+ * @param processingTime time the worker took to process the chunk (in seconds)
+ * @param waitingTime time the worker waited for the chunk (in seconds)
+ */
+extern void chunkProcessed(struct chunkTuner *tuner, unsigned int chunkSize, double processingTime, double waitingTime);
+
+#endif /* TUNER_H */
@@ -10,12 +10,23 @@
  */
 
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "constants.h"
+#include "simd.h"
+#include "words.h"
+#include "classes.h"
+#include "decompress.h"
+#include "metrics.h"
 
 /* Number of files to be processed */
 extern int numFiles;
@@ -26,17 +37,43 @@ extern int CHUNK_BYTE_LIMIT;
 /* Number of threads */
 extern int numThreads;
 
-/* Stores the index of the current file being proccessed by the working processes */
+/* Stores the position (in the schedule of the files) of the current file being proccessed by the working processes */
 extern int currentFileIndex;
 
+/* Tells if the workers read their chunks from the files themselves (the dispatcher only sends byte ranges) */
+extern bool parallelIO;
+
+/* Number of most frequent words printed per file (0 if the words aren't counted) */
+extern int topK;
+
+/* Metrics selected with --metrics (0 if there are none) */
+extern int metricsMask;
+
 /* File structure declaration - will be used to store file related data (numWords, etc..) */
 struct fileInfo *files;
 
-/** Process control variable - used to know if there's still work to be done (or not) 
- * 0 -> Work is not done yet. There are still chunks/files that need to be read and/or processed
- * (!= 0) -> If workStatus = N, then process N received the last chunk and needs to process it, while others processes dont ask for another job/chunk
+/**
+ * @brief Chunk sent by the dispatcher whose summary wasn't merged yet into the results of its file
+ * 
  */
-extern int workStatus;  
+struct pendingChunk {
+    unsigned int fileIndex;
+    bool isLast;                    /* Tells if it's the last chunk of its file */
+    bool isReceived;                /* Tells if its summary was already received */
+    struct chunkSummary summary;
+    struct wordFragments fragments;
+};
+
+/* Circular buffer with the chunks that weren't merged yet, in the order they were sent (grows as needed) */
+static struct pendingChunk *pendingChunks = NULL;
+static unsigned int pendingCapacity = 0;
+static unsigned int pendingStart = 0;       /* Position of the oldest chunk in the circular buffer */
+static unsigned int pendingCount = 0;
+static unsigned int firstPendingChunk = 0;  /* Index of the oldest chunk */
+
+/* Indexes of the files in the order they're read (set by scheduleFiles(), in the order of the command line if NULL) */
+static int *fileOrder = NULL;
+
 
 
 /**
@@ -50,116 +87,356 @@ void storeFilenames(struct fileInfo *files, char *filenames[]) {
     // Initialize each element of 'files' of struct file 
     for (int i = 0; i < numFiles; i++) {
         memset((files + i), 0, sizeof(struct fileInfo));
-        (files + i)->fp = NULL;
+        (files + i)->fd = -1;
+        (files + i)->data = NULL;
         (files + i)->filename = filenames[i];
+        /* Compressed files are decompressed while they're read (stdin can't be inspected without reading it) */
+        (files + i)->compression = (strcmp(filenames[i], "-") == 0) ? COMPRESSION_NONE : getCompression(filenames[i]);
+        /* The start of the file ends a word, like a separator */
+        (files + i)->summary.hasSeparator = true;
+        (files + i)->summary.hasTerminator = true;
+        (files + i)->fragments.hasSeparator = true;
         (files + i)->numWords = 0;
         for (int j = 0; j < 6; j++) {
             (files + i)->nWordsWithVowel[j] = 0;
         }
         (files + i)->isFinished = false;
+        (files + i)->isOpened = false;
     }
 
 }
 
 
 /**
- * @brief Get the Chunk object of the current file we're reading
- * Byte for byte reading of the file until the chunk reached the CHUNK_BYTE_LIMIT
- * Finishes if CHUNK_BYTE_LIMIT is reached or if we reach the EOF
- * The function removes word offset bytes from the chunk so that the next chunk can
- * fully read the word
+ * @brief Entry of the schedule of the files, sorted by scheduleOrder()
  * 
+ */
+struct scheduledFile {
+    int fileIndex;
+    bool isStream;
+    size_t bytesLeft;
+};
+
+
+/**
+ * @brief Order of the schedule: the streams first (their size is unknown), in the order of the command line, and then
+ * the regular files from the most to the fewest bytes left (the order of the command line between files of the same size)
  * 
- * @param chunkData  fileChunk structure
- * @param rank  of the MPI process
+ * @param a scheduledFile structure
+ * @param b scheduledFile structure
+ * @return negative if a is read before b, positive otherwise
  */
-unsigned int getChunk(struct fileChunk *chunkData, int rank) {
+static int scheduleOrder(const void *a, const void *b) {
 
-    /* There are files still remanining to be processed */
-    if (currentFileIndex < numFiles) {
+    const struct scheduledFile *fileA = (const struct scheduledFile *) a;
+    const struct scheduledFile *fileB = (const struct scheduledFile *) b;
 
-        /* Create file pointer if it doesn't exist (singleton) */
-        if ((files + currentFileIndex)->fp == NULL) {
+    if (fileA->isStream != fileB->isStream) {
+        return fileA->isStream ? -1 : 1;
+    }
+    if (!fileA->isStream && fileA->bytesLeft != fileB->bytesLeft) {
+        return (fileA->bytesLeft > fileB->bytesLeft) ? -1 : 1;
+    }
 
-            (files + currentFileIndex)->fp = fopen((files + currentFileIndex)->filename, "rb");
-            if ( (files + currentFileIndex)->fp == NULL) {
-                printf("[ERROR] Can't open file %s\n", (files + currentFileIndex)->filename);
-                exit(1);
-            }
-        } 
+    return fileA->fileIndex - fileB->fileIndex;
 
-        int byteIndex = 0;
-        int dividedWordOffset = 0;
-        char *charHexadecimal = (char *) malloc(12 * sizeof(char));    /* Byte limit of hexadecimal string */
-        int remainingBytes = 0;
+}
 
-        chunkData->fileIndex = currentFileIndex;
-        chunkData->isFinished = false; 
 
-        while (byteIndex < CHUNK_BYTE_LIMIT) {
+/**
+ * @brief Sets the order in which the files are read, largest first (longest processing time first): the chunks of
+ * the large files are sent while the chunks of the other files can fill the gaps, and the last chunks sent are the
+ * ones of the smallest files, so the workers end together instead of waiting for the last chunks of a large file.
+ * The results are still attributed by the index of the file (the order of the command line). Called after the
+ * files that are in the cache were looked up (the bytes that are left are the ones that count)
+ * 
+ */
+void scheduleFiles() {
 
-            int byte = fgetc((files + currentFileIndex)->fp);
+    struct scheduledFile *schedule = (struct scheduledFile *) malloc(numFiles * sizeof(struct scheduledFile));
+    fileOrder = (int *) realloc(fileOrder, numFiles * sizeof(int));
+    if ((schedule == NULL || fileOrder == NULL) && numFiles > 0) {
+        printf("[ERROR] Can't allocate memory for the schedule of the files\n");
+        exit(1);
+    }
 
-            /* EOF byte */
-            if (byte == EOF) {
+    for (int i = 0; i < numFiles; i++) {
+        struct fileInfo *file = files + i;
+        struct stat fileStat;
+        (schedule + i)->fileIndex = i;
+        (schedule + i)->isStream = (strcmp(file->filename, "-") == 0 || file->compression != COMPRESSION_NONE ||
+                                    (stat(file->filename, &fileStat) == 0 && !S_ISREG(fileStat.st_mode)));
+        (schedule + i)->bytesLeft = 0;
+        if (!(schedule + i)->isStream && !file->isFinished && stat(file->filename, &fileStat) == 0 &&
+            (size_t) fileStat.st_size > file->offset) {
+            (schedule + i)->bytesLeft = fileStat.st_size - file->offset;
+        }
+    }
 
-                fclose((files + currentFileIndex)->fp);
+    qsort(schedule, numFiles, sizeof(struct scheduledFile), scheduleOrder);
+    for (int i = 0; i < numFiles; i++) {
+        fileOrder[i] = (schedule + i)->fileIndex;
+    }
+    free(schedule);
 
-                currentFileIndex++;
-                dividedWordOffset = 0;
-                chunkData->chunkSize = byteIndex;
-                chunkData->isFinished = true;
+}
 
-                if (currentFileIndex == numFiles) {
-                    workStatus = rank;
-                } 
 
-                break;
-            }
+/**
+ * @brief Get the index of the file read at a position of the schedule (set by scheduleFiles())
+ * 
+ * @param position position in the schedule
+ * @return index of the file
+ */
+int getScheduledFile(int position) {
 
-            char byteHexadecimal[9];
-            sprintf(byteHexadecimal, "%02x", byte);
+    return (fileOrder == NULL) ? position : fileOrder[position];
 
-            /* Initial byte. Calculate how many are left according to UTF-8 standards */
-            if (remainingBytes == 0) {
-                remainingBytes = getRemainingBytes(byte);
-                strcpy(charHexadecimal, "0x");
-            }
+}
 
-            charHexadecimal = strcat(charHexadecimal, byteHexadecimal);
-            dividedWordOffset++;
-            remainingBytes--;
 
-            if (remainingBytes == 0) {
+/**
+ * @brief Opens a file and maps it into memory (read-only). Empty files are not mapped, and neither
+ * are the files read by the workers themselves (parallelIO), whose size is all the dispatcher needs.
+ * Streams (stdin, given as "-", pipes and FIFOs) can't be mapped: they are read by getChunk(), like
+ * the compressed files, which are read through their decompression stage. Regular files are closed once
+ * they're mapped (the mapping stays), so any number of files can be read
+ * 
+ * @param file fileInfo structure of the file
+ */
+void mapFile(struct fileInfo *file) {
 
-                // If retrieveIndexFromHexadecimal returns 6, the character is separation or punctuation
-                if (retrieveIndexFromHexadecimal(charHexadecimal) == 6) {
-                    dividedWordOffset = 0;
-                };
+    struct stat fileStat;
 
-                strcpy(charHexadecimal,"");
+    file->isOpened = true;
 
-            }
+    if (file->compression != COMPRESSION_NONE) {
+        file->fd = openDecompressor(file);
+        file->isStream = true;
+        file->fileSize = 0;
+        return;
+    }
+
+    file->fd = (strcmp(file->filename, "-") == 0) ? STDIN_FILENO : open(file->filename, O_RDONLY);
+    if (file->fd < 0 || fstat(file->fd, &fileStat) < 0) {
+        printf("[ERROR] Can't open file %s\n", file->filename);
+        exit(1);
+    }
 
-            chunkData->chunk[byteIndex++] = byte;  
+    file->isStream = !S_ISREG(fileStat.st_mode);
 
+    /* The size of a stream grows as it's read */
+    if (file->isStream) {
+        file->fileSize = 0;
+        return;
+    }
+
+    file->fileSize = fileStat.st_size;
+
+    if (file->fileSize > 0 && !parallelIO) {
+        file->data = mmap(NULL, file->fileSize, PROT_READ, MAP_PRIVATE, file->fd, 0);
+        if (file->data == MAP_FAILED) {
+            printf("[ERROR] Can't map file %s\n", file->filename);
+            exit(1);
         }
+        madvise(file->data, file->fileSize, MADV_SEQUENTIAL);
+    }
 
-        if (!chunkData->isFinished) {
+    close(file->fd);
+    file->fd = -1;
 
-            chunkData->chunkSize = CHUNK_BYTE_LIMIT - dividedWordOffset;
+}
 
-            /* Remove word offset bytes from the chunk */
-            for (int i = 1; i <= dividedWordOffset; i++) {
 
-                chunkData->chunk[CHUNK_BYTE_LIMIT - i] = '\0';
-            }
+/**
+ * @brief Unmaps and closes all the files that were mapped by mapFile()
+ * 
+ */
+void closeFiles() {
+
+    for (int i = 0; i < numFiles; i++) {
+        if ((files + i)->data != NULL) {
+            munmap((files + i)->data, (files + i)->fileSize);
+            (files + i)->data = NULL;
+        }
+        if ((files + i)->fd >= 0) {
+            close((files + i)->fd);
+            (files + i)->fd = -1;
+        }
+    }
+
+    /* The decompression stages ended with their files */
+    waitDecompressors();
+
+    free(fileOrder);
+    fileOrder = NULL;
+
+}
+
+
+/**
+ * @brief Moves currentFileIndex to the first file of the schedule that still has bytes to be read, mapping it if needed
+ * 
+ */
+static void skipFinishedFiles() {
+
+    while (currentFileIndex < numFiles) {
+
+        struct fileInfo *file = files + getScheduledFile(currentFileIndex);
+
+        if (!file->isOpened && !file->isFinished) {
+            mapFile(file);
+        }
+        if (file->isStream || file->offset < file->fileSize) {
+            return;
+        }
+
+        file->isFinished = true;
+        currentFileIndex++;
+
+    }
+
+}
+
+
+/**
+ * @brief Appends a chunk to the circular buffer of the chunks that weren't merged yet, doubling its capacity if it's full
+ * 
+ * @param fileIndex index of the file of the chunk
+ * @param isLast tells if it's the last chunk of the file
+ * @return index of the chunk
+ */
+static unsigned int registerChunk(unsigned int fileIndex, bool isLast) {
+
+    if (pendingCount == pendingCapacity) {
+
+        unsigned int capacity = (pendingCapacity == 0) ? 64 : 2 * pendingCapacity;
+        struct pendingChunk *chunks = (struct pendingChunk *) malloc(capacity * sizeof(struct pendingChunk));
+        if (chunks == NULL) {
+            printf("[ERROR] Can't allocate memory for the pending chunks\n");
+            exit(1);
+        }
+
+        for (unsigned int i = 0; i < pendingCount; i++) {
+            chunks[i] = pendingChunks[(pendingStart + i) % pendingCapacity];
+        }
+        free(pendingChunks);
+        pendingChunks = chunks;
+        pendingCapacity = capacity;
+        pendingStart = 0;
+
+    }
+
+    struct pendingChunk *chunk = pendingChunks + (pendingStart + pendingCount) % pendingCapacity;
+    chunk->fileIndex = fileIndex;
+    chunk->isLast = isLast;
+    chunk->isReceived = false;
+    pendingCount++;
+
+    return firstPendingChunk + pendingCount - 1;
+
+}
+
+
+/**
+ * @brief Reads the bytes available in a stream (up to maxBytes), waiting for them if there are none
+ * 
+ * @param file fileInfo structure of the stream
+ * @param buffer buffer with space for maxBytes bytes
+ * @param maxBytes maximum number of bytes
+ * @return number of bytes read, 0 at the end of the stream
+ */
+static size_t readStream(struct fileInfo *file, unsigned char *buffer, unsigned int maxBytes) {
+
+    ssize_t bytesRead;
+
+    do {
+        bytesRead = read(file->fd, buffer, maxBytes);
+    } while (bytesRead < 0 && errno == EINTR);
+
+    if (bytesRead < 0) {
+        printf("[ERROR] Can't read %s\n", file->filename);
+        exit(1);
+    }
+
+    return bytesRead;
+
+}
+
+
+/**
+ * @brief Get the Chunk object of the current file we're reading (the files are read in the order of the schedule)
+ * The chunk points to the memory mapped file (no bytes are copied) and has maxBytes bytes
+ * (except at the end of the file). The file isn't inspected: words and UTF-8 sequences cut by the
+ * chunk are put together when the chunk summaries are merged (addChunkSummary())
+ * 
+ * If the workers read the files themselves (parallelIO), only the byte range is set (chunk is NULL)
+ * 
+ * The chunks of a stream are read into buffer, with the bytes available (up to maxBytes), so that the
+ * results keep up with a slow stream. A stream ends when it has no bytes left
+ * 
+ * @param chunkData  fileChunk structure
+ * @param maxBytes size of the chunk (at most CHUNK_BYTE_LIMIT bytes)
+ * @param buffer buffer with space for maxBytes bytes, where the chunks of streams are read (NULL if there are no streams)
+ * @return size of the chunk, 0 if all files have been read
+ */
+unsigned int getChunk(struct fileChunk *chunkData, unsigned int maxBytes, unsigned char *buffer) {
+
+    /* Empty chunk, if there are no files left */
+    chunkData->fileIndex = 0;
+    chunkData->chunkIndex = 0;
+    chunkData->offset = 0;
+    chunkData->chunk = NULL;
+    chunkData->chunkSize = 0;
+    chunkData->isFinished = false;
+
+    skipFinishedFiles();
+
+    /* The stream ends when there's nothing left to read: its results are set after the chunks already sent */
+    while (currentFileIndex < numFiles && (files + getScheduledFile(currentFileIndex))->isStream) {
+
+        int fileIndex = getScheduledFile(currentFileIndex);
+        struct fileInfo *file = files + fileIndex;
+        size_t bytesRead = readStream(file, buffer, maxBytes);
+
+        if (bytesRead > 0) {
+            chunkData->fileIndex = fileIndex;
+            chunkData->chunkIndex = registerChunk(fileIndex, false);
+            chunkData->offset = file->offset;
+            chunkData->chunk = buffer;
+            chunkData->chunkSize = bytesRead;
+            file->offset += bytesRead;
+            file->fileSize = file->offset;
+            return chunkData->chunkSize;
+        }
 
-            /* Fall back pointer to the position of the last punctuation/separation character */
-            fseek((files + currentFileIndex)->fp, -dividedWordOffset, SEEK_CUR);
-        
+        struct chunkSummary empty;
+        memset(&empty, 0, sizeof(struct chunkSummary));
+        addChunkSummary(registerChunk(fileIndex, true), &empty, NULL);
+        file->isFinished = true;
+        currentFileIndex++;
+        skipFinishedFiles();
+
+    }
+
+    /* There are files still remanining to be processed */
+    if (currentFileIndex < numFiles) {
+
+        int fileIndex = getScheduledFile(currentFileIndex);
+        struct fileInfo *file = files + fileIndex;
+        size_t end = file->offset + maxBytes;
+
+        if (end > file->fileSize) {
+            end = file->fileSize;
         }
 
+        chunkData->fileIndex = fileIndex;
+        chunkData->chunkIndex = registerChunk(fileIndex, end == file->fileSize);
+        chunkData->offset = file->offset;
+        chunkData->chunk = parallelIO ? NULL : file->data + file->offset;
+        chunkData->chunkSize = end - file->offset;
+        chunkData->isFinished = (end == file->fileSize);
+        file->offset = end;
 
     }
 
@@ -169,24 +446,225 @@ unsigned int getChunk(struct fileChunk *chunkData, int rank) {
 
 
 /**
- * @brief Resets the fileChunk structure
+ * @brief Resets the fileChunk structure (partial results), keeping its chunk buffer
  * 
  * @param chunkData 
  */
 void resetChunkData(struct fileChunk *chunkData) {
     
     chunkData->chunkSize = CHUNK_BYTE_LIMIT;
-    chunkData->chunk = (unsigned char *) malloc(CHUNK_BYTE_LIMIT * sizeof(unsigned char));
     chunkData->fileIndex = 0;
-    chunkData->numWords = 0;
-    for (int i = 0; i < 6; i++) {
-        chunkData->nWordsWithVowel[i] = 0;
-    }
+    memset(&chunkData->summary, 0, sizeof(struct chunkSummary));
+    memset(&chunkData->fragments, 0, sizeof(struct wordFragments));
     chunkData->isFinished = false;
 
 }
 
 
+/**
+ * @brief Adds a character to the end of the range of a summary
+ * 
+ * @param summary summary of the range
+ * @param codePoint code point of the character
+ */
+static void addCharacter(struct chunkSummary *summary, unsigned int codePoint) {
+
+    int charClass = getCharClass(codePoint);
+
+    if (metricsMask != 0) {
+        countMetrics(summary, codePoint, charClass);
+    }
+
+    /* Before the first separator the vowels are only saved, they're counted when the range is merged */
+    if (!summary->hasSeparator) {
+        if (charClass <= CHAR_CLASS_Y) {
+            summary->lead.inWord = true;
+            summary->lead.wordVowels |= 1u << charClass;
+            summary->lead.length++;
+        } else if (charClass == CHAR_CLASS_OTHER) {
+            summary->lead.inWord = true;
+            summary->lead.length++;
+        } else if (charClass == CHAR_CLASS_SEPARATOR) {
+            summary->hasSeparator = true;
+        }
+        return;
+    }
+
+    if (charClass <= CHAR_CLASS_Y) {
+        summary->trail.inWord = true;
+        summary->trail.length++;
+        if (!(summary->trail.wordVowels & (1u << charClass))) {
+            summary->nWordsWithVowel[charClass] += 1;
+            summary->trail.wordVowels |= 1u << charClass;
+        }
+    } else if (charClass == CHAR_CLASS_OTHER) {
+        summary->trail.inWord = true;
+        summary->trail.length++;
+    } else if (charClass == CHAR_CLASS_SEPARATOR && summary->trail.inWord) {
+        summary->numWords += 1;
+        if (metricsMask != 0) {
+            countWordLength(&summary->metrics, summary->trail.length);
+        }
+        summary->trail.inWord = false;
+        summary->trail.wordVowels = 0;
+        summary->trail.length = 0;
+    }
+
+}
+
+
+/**
+ * @brief Merges two summaries without the bytes of the UTF-8 sequences cut between them
+ * 
+ * @param left summary of the first range (updated)
+ * @param right summary of the next range
+ */
+static void appendSummary(struct chunkSummary *left, const struct chunkSummary *right) {
+
+    /* The word of left (its lead, or its trailing word) continues in the lead of right */
+    struct wordState *word = left->hasSeparator ? &left->trail : &left->lead;
+
+    if (metricsMask != 0) {
+        appendMetrics(left, right);
+    }
+
+    if (left->hasSeparator) {
+        unsigned int newVowels = right->lead.wordVowels & ~word->wordVowels;
+        for (int j = 0; j < 6; j++) {
+            left->nWordsWithVowel[j] += (newVowels >> j) & 1;
+        }
+    }
+
+    if (!right->hasSeparator) {
+        word->inWord |= right->lead.inWord;
+        word->wordVowels |= right->lead.wordVowels;
+        word->length += right->lead.length;
+        return;
+    }
+
+    if (!left->hasSeparator) {
+        /* Left has no counts yet, the lead of both is the lead of the merged range */
+        left->lead.inWord |= right->lead.inWord;
+        left->lead.wordVowels |= right->lead.wordVowels;
+        left->lead.length += right->lead.length;
+        left->hasSeparator = true;
+    } else if (word->inWord || right->lead.inWord) {
+        /* The first separator of right ends the trailing word of left */
+        left->numWords += 1;
+        if (metricsMask != 0) {
+            countWordLength(&left->metrics, word->length + right->lead.length);
+        }
+    }
+
+    left->numWords += right->numWords;
+    for (int j = 0; j < 6; j++) {
+        left->nWordsWithVowel[j] += right->nWordsWithVowel[j];
+    }
+    left->trail = right->trail;
+
+}
+
+
+/**
+ * @brief Merges the summary of the byte range that follows the range of left into left (left = left + right)
+ * 
+ * @param left summary of the first range (updated)
+ * @param right summary of the next range
+ */
+void mergeSummaries(struct chunkSummary *left, const struct chunkSummary *right) {
+
+    /* The characters between both ranges: the incomplete sequence of left and the continuation bytes of right */
+    struct chunkSummary junction;
+    unsigned char bytes[6];
+    unsigned int length = left->tailSize + right->headSize;
+
+    memset(&junction, 0, sizeof(struct chunkSummary));
+    memcpy(bytes, left->tail, left->tailSize);
+    memcpy(bytes + left->tailSize, right->head, right->headSize);
+
+    for (unsigned int i = 0; i < length; ) {
+        /* A sequence that is still incomplete is an invalid character (the next byte isn't a continuation byte) */
+        unsigned int charLength = getCharLength(bytes + i, length - i);
+        if (charLength > length - i) {
+            charLength = length - i;
+        }
+        addCharacter(&junction, decodeUTF8(bytes + i, charLength));
+        i += charLength;
+    }
+
+    appendSummary(left, &junction);
+    appendSummary(left, right);
+
+    memcpy(left->tail, right->tail, right->tailSize);
+    left->tailSize = right->tailSize;
+
+}
+
+
+/**
+ * @brief Sets the results of a file once the summaries of all its chunks were merged (in order) into its summary.
+ * The summary itself is kept as it is, so that the bytes appended to the file can still be merged into it (--cache)
+ *
+ * @param file file whose last chunk was merged
+ */
+void finishFileSummary(struct fileInfo *file) {
+
+    /* The end of the file completes its last UTF-8 sequence (the word that didn't end isn't counted) */
+    struct chunkSummary end, summary = file->summary;
+    memset(&end, 0, sizeof(struct chunkSummary));
+    mergeSummaries(&summary, &end);
+    file->numWords = summary.numWords;
+    memcpy(file->nWordsWithVowel, summary.nWordsWithVowel, sizeof(file->nWordsWithVowel));
+    file->metrics = summary.metrics;
+
+}
+
+/**
+ * @brief Adds the summary of a chunk returned by getChunk() to the results of its file. The chunks may
+ * arrive in any order: they wait (in a circular buffer that grows as needed) until all the chunks sent
+ * before them were merged, and the results of a file are set once its last chunk is merged
+ * 
+ * With --top, the word fragments of the chunk are put together in the same order (mergeWordFragments())
+ * 
+ * @param chunkIndex index of the chunk (set by getChunk())
+ * @param summary summary of the chunk
+ * @param fragments word fragments of the chunk (NULL if it has none)
+ */
+void addChunkSummary(unsigned int chunkIndex, const struct chunkSummary *summary, const struct wordFragments *fragments) {
+
+    struct pendingChunk *chunk = pendingChunks + (pendingStart + chunkIndex - firstPendingChunk) % pendingCapacity;
+    chunk->summary = *summary;
+    if (fragments != NULL) {
+        chunk->fragments = *fragments;
+    } else {
+        memset(&chunk->fragments, 0, sizeof(struct wordFragments));
+    }
+    chunk->isReceived = true;
+
+    /* Merge the oldest chunks, while all the chunks sent before them were merged */
+    while (pendingCount > 0 && pendingChunks[pendingStart].isReceived) {
+
+        chunk = pendingChunks + pendingStart;
+        struct fileInfo *file = files + chunk->fileIndex;
+        if (topK > 0) {
+            /* Before the summaries are merged, since the character cut by the chunks is in the tail of the file's summary */
+            mergeWordFragments(chunk->fileIndex, &file->fragments, &file->summary, &chunk->fragments, &chunk->summary);
+        }
+        mergeSummaries(&file->summary, &chunk->summary);
+
+        if (chunk->isLast) {
+            finishFileSummary(file);
+        }
+
+        pendingStart = (pendingStart + 1) % pendingCapacity;
+        pendingCount--;
+        firstPendingChunk++;
+
+    }
+
+}
+
+
 /**
  * @brief Get the Results object
  * 
@@ -197,11 +675,17 @@ void getResults() {
 
 
         printf("ANALYSING FILE: %s\n", (files + i)->filename);
-        printf("Total number of words: %d\n", (files + i)->numWords);
+        printf("Total number of words: %" PRIu64 "\n", (files + i)->numWords);
         printf("Number of words with an\n");
 
         printf("%10c %10c %10c %10c %10c %10c\n", 'A', 'E', 'I', 'O', 'U', 'Y');
-        printf("%10u %10u %10u %10u %10u %10u\n\n\n", (files + i)->nWordsWithVowel[0],(files + i)->nWordsWithVowel[1],(files + i)->nWordsWithVowel[2],(files + i)->nWordsWithVowel[3],(files + i)->nWordsWithVowel[4],(files + i)->nWordsWithVowel[5]);
+        printf("%10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", (files + i)->nWordsWithVowel[0],(files + i)->nWordsWithVowel[1],(files + i)->nWordsWithVowel[2],(files + i)->nWordsWithVowel[3],(files + i)->nWordsWithVowel[4],(files + i)->nWordsWithVowel[5]);
+
+        /* Metrics of the fused pass (--metrics) */
+        if (metricsMask != 0) {
+            printMetrics(files + i);
+        }
+        printf("\n\n");
 
 
     }
@@ -210,70 +694,53 @@ void getResults() {
 
 
 /**
- * @brief Retrieves an index which will be used to identify the character ('a','e','i','o','u','y',<separation/whitespace/punctiation>,<other>)
+ * @brief Prints the results of the chunks of each stream merged so far (running totals)
  * 
- * @param hex Hexadecimal character representation
- * @return 
- *  0 if 'a'
- *  1 if 'e'
- *  2 if 'i'
- *  3 if 'o'
- *  4 if 'u'
- *  5 if 'y'
- *  6 if SEPARATION, WHITESPACE or PUNCTUATION
- * -1 if other character (consonant)
+ * @param elapsed time since the start (in seconds)
  */
-int retrieveIndexFromHexadecimal(char* hex) {
-
-    /**
-     * @brief Bi-dimensional array that stores the string literal of different types of characters (vowels and separators/whitespaces/punctuation)
-     * 
-     */
-    const char* arrays[][30] = {
-        {"0x41", "0x61", "0xc380", "0xc381", "0xc382", "0xc383", "0xc384", "0xc385", "0xc386", "0xc3a0", "0xc3a1", "0xc3a2", "0xc3a3", "0xc3a4", "0xc3a5", "0xc3a6"},                                                                                       // a
-        {"0x45", "0x65", "0xc388", "0xc389", "0xc38a", "0xc38b", "0xc3a8", "0xc3a9", "0xc3aa", "0xc3ab"},                                                                                                                                                   // e
-        {"0x49", "0x69", "0xc38c", "0xc38d", "0xc38e", "0xc38f", "0xc3ac", "0xc3ad", "0xc3ae", "0xc2af"},                                                                                                                                                   // i
-        {"0x4f", "0x6f", "0xc392", "0xc393", "0xc394", "0xc395", "0xc396", "0xc398", "0xc3b2", "0xc3b3", "0xc3b4", "0xc3b5", "0xc3b6", "0xc3b8"},                                                                                                           // o
-        {"0x55", "0x75", "0xc399", "0xc39a", "0xc39b", "0xc39c", "0xc3b9", "0xc3ba", "0xc3bb", "0xc3bc", "0xc3bd"},                                                                                                                                         // u
-        {"0x59", "0x79", "0xc39d", "0xc3bd", "0xc3bf"},                                                                                                                                                                                                     // y                                            
-        {"0x20", "0x27", "0x60", "0xe28098", "0xe28099", "0x09", "0x0a", "0x0d", "0x22", "0x2d", "0xe2809c", "0xe2809d", "0x5b", "0x5d", "0x28", "0x29", "0x2c", "0x2e", "0x3a", "0x3b", "0x3f", "0x21", "0xe28093", "0xe280a6", "0x5f", "0xc2bb", "0xc2ab", "0xc2a8", "0xe28094", "0xe28093"}      // SEPARATION, WHITESPACE,PUNCTUATION
-    };
-
-    const int num_arrays = sizeof(arrays) / sizeof(arrays[0]);
-    const int num_elements = sizeof(arrays[0]) / sizeof(arrays[0][0]);
-
-    /**
-     * @brief Iterate through the different arrays and, if some string literal matches the hexadecimal argument, return the index of the array
-     * 
-     */
-    for (int i = 0; i < num_arrays; i++) {
-        for (int j = 0; j < num_elements; j++) {
-            const char *arrayHex = arrays[i][j];
-            if (!arrayHex) {
-                continue;
-            }
-            if (strcmp(hex, arrayHex) == 0) {
-                return i;
-            }
+void printRunningTotals(double elapsed) {
+
+    for (int i = 0; i < numFiles; i++) {
+
+        if (!(files + i)->isStream) {
+            continue;
         }
-    }
 
-    /* In the case of a consonant */
-    return -1;
+        struct chunkSummary *summary = &(files + i)->summary;
+        printf("RUNNING TOTALS (%.1f s) %s: %" PRIu64 " words | A %" PRIu64 " E %" PRIu64 " I %" PRIu64 " O %" PRIu64 " U %" PRIu64 " Y %" PRIu64 "\n", elapsed, (files + i)->filename, summary->numWords,
+               summary->nWordsWithVowel[0], summary->nWordsWithVowel[1], summary->nWordsWithVowel[2],
+               summary->nWordsWithVowel[3], summary->nWordsWithVowel[4], summary->nWordsWithVowel[5]);
+
+    }
+    fflush(stdout);
 
 }
 
 
 /**
- * @brief Resets all wordHasVowels variable to zero
+ * @brief Decodes an UTF-8 sequence into its code point
  * 
- * @param wordHasVowels array of booleans to know if a certain vowel (specified by the index) was already processed in the current word
- * @return void 
+ * @param bytes first byte of the sequence
+ * @param length number of bytes of the sequence (given by getCharLength())
+ * @return code point of the character (UTF8_REPLACEMENT_CHAR if the sequence is invalid) 
  */
-void resetWordVowels(bool wordHasVowels[6]) {
+unsigned int decodeUTF8(const unsigned char *bytes, int length) {
+
+    /* Sequence with less continuation bytes than announced by its first byte */
+    if (length != getRemainingBytes(bytes[0])) {
+        return UTF8_REPLACEMENT_CHAR;
+    }
 
-    for (int i=0; i < 6; i++) {
-        wordHasVowels[i] = false;   
+    switch (length) {
+        case 1:
+            /* A continuation byte can't start a character */
+            return (bytes[0] < 0x80) ? bytes[0] : UTF8_REPLACEMENT_CHAR;
+        case 2:
+            return ((bytes[0] & 0x1F) << 6) | (bytes[1] & 0x3F);
+        case 3:
+            return ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) | (bytes[2] & 0x3F);
+        default:
+            return ((bytes[0] & 0x07) << 18) | ((bytes[1] & 0x3F) << 12) | ((bytes[2] & 0x3F) << 6) | (bytes[3] & 0x3F);
     }
 
 }
@@ -302,98 +769,199 @@ int getRemainingBytes(int byte) {
 }
 
 /**
- * @brief Reads the chunkData->chunkSize bytes belonging to chunkData->chunk and
- * calculates the number of words (numWords) and the number of words with vowels
- * (nWordsWithVowel) of the given chunk
+ * @brief Get the number of bytes of the character that starts at bytes. A sequence that has less
+ * continuation bytes than announced by its first byte is an (invalid) character by itself, so that
+ * any byte that isn't a continuation byte starts a character
  * 
- * @param chunkData 
+ * @param bytes first byte of the character
+ * @param available number of bytes that can be read
+ * @return number of bytes of the character (the announced length if the sequence doesn't fit in the available bytes)
  */
-void processChunk(struct fileChunk *chunkData) {
+int getCharLength(const unsigned char *bytes, unsigned int available) {
 
-    char *charHexadecimal = (char *) malloc(12 * sizeof(char));             /* Byte limit of hexadecimal string */
-    strcpy(charHexadecimal, "0x");                                          // Used to store full hexadecimal representation of character
-    int remainingBytes = 0;                                                 // Calculates how many bytes are left for the UTF-8 character. If byte 0 is 0xxxxxxx = 0, 110xxxxx = 1, 1110xxxx = 2, etc...
-    bool inWord = false;                                                    // Tells if we're still iterating through a word character
-    bool wordHasVowels[6] = { 0,0,0,0,0,0 };                                // Array that checks if vowels exist in word
-
-    int byte;
-
-    for (int i = 0; i < chunkData->chunkSize; i++) {
-
-        byte = chunkData->chunk[i];
-
-        /* Get string representation of the last hexadecimal (byte) */
-        char lastHexadecimal[9];
-        sprintf(lastHexadecimal, "%02x", byte);
-
-        // Check if character has, or not, continuation.
-        // If it doesn't have, calculate the character with the retrieve_character_from_byte
-        // Else, wait to append the other bytes
-
-        // Read first hexadecimal and check how many bytes are left according to byte 0 (initial)
-        if (strcmp(charHexadecimal, "0x") == 0) {
-
-            if (byte < 192) {
-                // 0x0XXXXXXX
-                remainingBytes = 1;
-            } else if(byte >= 192 && byte < 224) {
-                // 0x110XXXXX
-                remainingBytes = 2;
-            } else if(byte >= 224 && byte < 240) {
-                // 0x1110XXXX
-                remainingBytes = 3;
-            } else if(byte >= 240) {
-                //0x11110XXX
-                remainingBytes = 4;
-            }
+    int length = getRemainingBytes(bytes[0]);
+
+    for (int i = 1; i < length; i++) {
+        if ((unsigned int) i == available) {
+            return length;
+        }
+        if ((bytes[i] & 0xC0) != 0x80) {
+            return i;
+        }
+    }
+
+    return length;
 
+}
+
+/**
+ * @brief Counts a character of a chunk, after the first separator, updating the word state and the partial
+ * results of chunkData. Used by processBytes() and by the scalar kernel
+ * 
+ * @param chunkData fileChunk structure with the partial results
+ * @param state state of the word being read
+ * @param charClass class of the character
+ */
+static inline void countCharacter(struct fileChunk *chunkData, struct wordState *state, int charClass) {
+
+    if (charClass <= CHAR_CLASS_Y) {
+
+        /* If it's a vowel, count it once per word */
+        state->inWord = true;
+        if (!(state->wordVowels & (1u << charClass))) {
+            chunkData->summary.nWordsWithVowel[charClass] += 1;
+            state->wordVowels |= 1u << charClass;
         }
 
-        charHexadecimal = strcat(charHexadecimal, lastHexadecimal);
+    } else if (charClass == CHAR_CLASS_SEPARATOR) {
 
-        if (remainingBytes > 1) {
+        if (state->inWord) {
+            chunkData->summary.numWords += 1;
+            state->wordVowels = 0;
+            state->inWord = false;
+        }
 
-            remainingBytes--;
+    } else if (charClass == CHAR_CLASS_OTHER) {
 
-        } else {
+        /* If it's other character than vowel or whitespaces */
+        state->inWord = true;
 
-            // Last remaining byte, build the hexadecimal representation of the UTF-8 character and process it
+    }
+
+    /* Apostrophes neither start nor end a word */
 
-            int index = retrieveIndexFromHexadecimal(charHexadecimal);
+}
 
 
-            if (index >= 0 && index <= 5) {
+/**
+ * @brief Processes, with the scalar state machine, the characters of a chunk that start
+ * between the byte indexes start and end, updating the word state and the partial results
+ * of chunkData. Used by the SIMD kernels for multi-byte characters
+ * 
+ * @param chunkData fileChunk structure with the chunk and the partial results
+ * @param state state of the word being read
+ * @param start index of the first byte to process
+ * @param end index where processing stops (a character may extend past it)
+ * @return index of the byte after the last processed character 
+ */
+unsigned int processBytes(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) {
 
-                // if it's a vowel
-                inWord = true;
-                
-                if (!wordHasVowels[index]) {
-                    chunkData->nWordsWithVowel[index] += 1;
-                    wordHasVowels[index] = true;
-                }
+    unsigned int i = start;
 
-            } else if (index == 6) {
+    while (i < end) {
 
-                if ( (strcmp(charHexadecimal, "0x27") != 0) && (strcmp(charHexadecimal, "0x60") != 0) && strcmp(charHexadecimal, "0xe28098") != 0 && strcmp(charHexadecimal, "0xe28099") != 0 ) {
+        int byte = chunkData->chunk[i];
+        int charClass;
 
-                    if (inWord) {
-                        chunkData->numWords += 1;
-                        resetWordVowels(wordHasVowels);
-                        inWord = false;
-                    }
-                }
+        if (byte < 0x80) {
 
-            } else {
+            /* ASCII fast path, the byte is the code point */
+            charClass = getCharClass(byte);
+            i++;
 
-                // If it's other character than vowel or whitespaces
-                inWord = true;
+        } else {
 
+            /* Multi-byte character, decode it only when all of its bytes are in the chunk */
+            int length = getCharLength(chunkData->chunk + i, chunkData->chunkSize - i);
+            if (i + length > chunkData->chunkSize) {
+                return chunkData->chunkSize;
             }
+            charClass = getCharClass(decodeUTF8(chunkData->chunk + i, length));
+            i += length;
 
-            strcpy(charHexadecimal,"0x");
+        }
 
+        countCharacter(chunkData, state, charClass);
+
+    }
+
+    return i;
+
+}
+
+
+/**
+ * @brief Scalar kernel of processChunk(), decodes and classifies the characters between the byte
+ * indexes start and end with the DFA compiled from the character classes (a table lookup per byte)
+ * 
+ * @param chunkData 
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+void processChunkScalar(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end) {
+
+    const unsigned char *chunk = chunkData->chunk;
+    const uint32_t *transitions = classDFA;
+    uint32_t dfaState = 0;
+
+    /* A transition per byte, which completes 0, 1 or 2 characters */
+    for (unsigned int i = start; i < end; i++) {
+        uint32_t transition = transitions[dfaState * 256 + chunk[i]];
+        if (CLASS_DFA_FIRST(transition)) {
+            countCharacter(chunkData, state, CLASS_DFA_FIRST(transition) - 1);
+            if (CLASS_DFA_SECOND(transition)) {
+                countCharacter(chunkData, state, CLASS_DFA_SECOND(transition) - 1);
+            }
         }
+        dfaState = CLASS_DFA_STATE(transition);
+    }
 
+    /* A sequence without its last continuation bytes is an invalid character */
+    if (dfaState != 0) {
+        countCharacter(chunkData, state, getCharClass(UTF8_REPLACEMENT_CHAR));
     }
 
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Reads the chunkData->chunkSize bytes belonging to chunkData->chunk (any range of bytes of
+ * a file) and calculates its summary (chunkData->summary): the number of words and the number of
+ * words with vowels after the first separator (counted with the kernel chosen by selectChunkKernel(), or
+ * with the fused kernel of the metrics if there are metrics), the words cut by the ends of the chunk and
+ * the bytes of the UTF-8 sequences cut by them
+ * 
+ * @param chunkData 
+ */
+void processChunk(struct fileChunk *chunkData) {
+
+    struct chunkSummary *summary = &chunkData->summary;
+    unsigned char *chunk = chunkData->chunk;
+    unsigned int size = chunkData->chunkSize;
+    unsigned int start = 0, end = size;
+
+    /* Continuation bytes at the start, that belong to a character of the previous chunk (at most 3) */
+    while (start < size && start < 3 && (chunk[start] & 0xC0) == 0x80) {
+        summary->head[start] = chunk[start];
+        start++;
+    }
+    summary->headSize = start;
+
+    /* Incomplete sequence at the end (a first byte followed by less continuation bytes than it announces) */
+    for (unsigned int i = size; i > start && size - i < 3; i--) {
+        if ((chunk[i - 1] & 0xC0) != 0x80) {
+            if (chunk[i - 1] >= 0xC0 && (unsigned int) getRemainingBytes(chunk[i - 1]) > size - (i - 1)) {
+                end = i - 1;
+            }
+            break;
+        }
+    }
+    summary->tailSize = size - end;
+    memcpy(summary->tail, chunk + end, size - end);
+
+    /* Characters until the first separator (the word that continues the one of the previous chunk) */
+    while (start < end && !summary->hasSeparator) {
+        int length = getCharLength(chunk + start, size - start);
+        addCharacter(summary, decodeUTF8(chunk + start, length));
+        start += length;
+    }
+
+    /* The rest of the chunk starts after a separator (with --metrics, the fused kernel counts the metrics in the same pass) */
+    if (start < end && metricsMask != 0) {
+        processChunkMetrics(chunkData, &summary->trail, start, end);
+    } else if (start < end) {
+        chunkKernel(chunkData, &summary->trail, start, end);
+    }
+
+}
@@ -7,20 +7,86 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
 
 #ifndef UTILS_H
 #define UTILS_H
 
+/**
+ * @brief Structure that saves the state of the word being read, so that a chunk can be processed in several steps
+ * 
+ */
+struct wordState {
+    bool inWord;                /* Tells if we're still iterating through a word character */
+    unsigned int wordVowels;    /* Bitmask of the vowels (bit i = class i) already found in the current word */
+    unsigned int length;        /* Number of characters of the current word, without its apostrophes (--metrics) */
+};
+
+/**
+ * @brief Counters of the metrics of the fused pass (--metrics), indexed by METRIC_COUNTER_*. The counters are flat, so
+ * that two ranges are merged with a single loop, and take whole cache lines
+ * 
+ */
+struct textMetrics {
+    uint64_t counters[NUM_METRIC_COUNTERS];
+};
+
+/**
+ * @brief Structure that summarizes any range of bytes of a file (which may cut a word or an UTF-8 sequence in half),
+ * so that the results of consecutive ranges can be merged in order with mergeSummaries()
+ * 
+ */
+struct chunkSummary {
+    uint64_t numWords;                      /* Words ended by the separators after the first one */
+    uint64_t nWordsWithVowel[6];            /* Words with each vowel after the first separator (including the trailing word) */
+    bool hasSeparator;                      /* Tells if there's a separator in the range */
+    struct wordState lead;                  /* Word before the first separator (the whole range if there's none) */
+    struct wordState trail;                 /* Word after the last separator, which continues in the next range */
+    unsigned char head[3];                  /* Continuation bytes at the start (of a character of the previous range) */
+    unsigned char headSize;
+    unsigned char tail[3];                  /* Incomplete UTF-8 sequence at the end (continued in the next range) */
+    unsigned char tailSize;
+    bool hasTerminator;                     /* Tells if there's a sentence terminator in the range (--metrics) */
+    bool leadSentence;                      /* Tells if there's a word character before the first terminator */
+    bool trailSentence;                     /* Tells if there's a word character after the last terminator (an open sentence) */
+    struct textMetrics metrics;             /* Metrics of the characters of the range, and of the words and sentences ended after its first separator/terminator */
+};
+
+/**
+ * @brief Structure with the words cut by the ends of a range of bytes (normalised, see words.c), so that the
+ * words of consecutive ranges can be put together in order with mergeWordFragments() (--top)
+ *
+ */
+struct wordFragments {
+    bool hasSeparator;                      /* Tells if there's a separator in the range */
+    unsigned char leadSize;
+    unsigned char trailSize;
+    char lead[MAX_WORD_BYTES];              /* Word before the first separator (the whole range if there's none) */
+    char trail[MAX_WORD_BYTES];             /* Word after the last separator, which continues in the next range */
+};
+
 /**
  * @brief Structure that saves the global results of each file (number of words and number of words with the vowels [aeiouy] )
  * 
  */
 struct fileInfo {
     char *filename;
-    FILE *fp;
-    unsigned int numWords;
-    unsigned int nWordsWithVowel[6];
+    int fd;                     /* File descriptor (-1 if the file isn't open) */
+    unsigned char *data;        /* File mapped into memory (NULL if it isn't mapped) */
+    size_t fileSize;
+    size_t offset;              /* Index of the first byte that wasn't sent in a chunk yet */
+    struct chunkSummary summary;    /* Summaries of the chunks merged so far (in order) */
+    struct wordFragments fragments; /* Word fragments of the chunks merged so far (--top) */
+    uint64_t numWords;
+    uint64_t nWordsWithVowel[6];
+    struct textMetrics metrics;     /* Metrics of the file (--metrics) */
+    bool isStream;              /* Stdin, pipe or FIFO: read (not mapped) by the dispatcher, its size is only known at the end */
+    int compression;            /* COMPRESSION_NONE, or the format of a compressed file (read as a stream, decompressed) */
     bool isFinished;
+    bool isOpened;              /* Tells if mapFile() was called (a mapped regular file is closed, its mapping stays) */
 };
 
 /**
@@ -29,13 +95,58 @@ struct fileInfo {
  */
 struct fileChunk {
     unsigned int fileIndex;
+    unsigned int chunkIndex;    /* Index of the chunk in the order the chunks were sent (all files) */
+    size_t offset;              /* Index (in the file) of the first byte of the chunk */
     unsigned char *chunk;
     unsigned int chunkSize;
-    unsigned int numWords;
-    unsigned int nWordsWithVowel[6];
+    struct chunkSummary summary;
+    struct wordFragments fragments; /* Words cut by the ends of the chunk (--top) */
     bool isFinished;
 };
 
+/**
+ * @brief Header of a chunk message. The chunkSize bytes of the chunk follow it in the same message
+ *
+ */
+struct chunkHeader {
+    unsigned int fileIndex;
+    unsigned int chunkIndex;
+    unsigned int chunkSize;
+    uint64_t offset;
+};
+
+/**
+ * @brief Super-chunk received by a node dispatcher from rank 0 (a chunk for each worker of its node), which is split
+ * into slices for the workers of its node. Its results are the summaries of its slices, merged in order
+ *
+ */
+struct superChunk {
+    struct chunkHeader header;      /* Header of the super-chunk (its index is the one of rank 0) */
+    unsigned char *data;            /* Bytes of the super-chunk (NULL if the workers read them, parallelIO) */
+    bool isReceived;                /* Tells if it has slices that weren't processed yet */
+    unsigned int sliceSize;
+    unsigned int numSlices;
+    unsigned int nextSlice;         /* Index of the first slice that wasn't sent */
+    unsigned int slicesDone;        /* Number of slices whose results were received */
+    double processingTime;          /* Processing time of all its slices */
+    double waitingTime;             /* Waiting time of all its slices */
+    struct chunkSummary *summaries; /* Summary of each slice */
+    struct wordFragments *fragments;    /* Word fragments of each slice (--top) */
+};
+
+/**
+ * @brief Partial results of a chunk, sent by a worker to the dispatcher in a single message
+ *
+ */
+struct chunkResults {
+    unsigned int chunkIndex;
+    unsigned int chunkSize;
+    double processingTime;      /* Time the worker took to process the chunk (in seconds) */
+    double waitingTime;         /* Time the worker waited for the chunk (in seconds) */
+    struct chunkSummary summary;
+    struct wordFragments fragments;
+};
+
 
 /**
  * @brief Get the text file names by processing the command line and storing them in the shared region for future retrieval by worker threads
@@ -46,22 +157,91 @@ struct fileChunk {
 extern void storeFilenames(struct fileInfo *files, char *filenames[]);
 
 
+/**
+ * @brief Opens a file and maps it into memory (read-only). Empty files are not mapped, and neither
+ * are the files read by the workers themselves (parallelIO), whose size is all the dispatcher needs.
+ * Streams (stdin, given as "-", pipes and FIFOs) can't be mapped: they are read by getChunk(), like
+ * the compressed files, which are read through their decompression stage. Regular files are closed once
+ * they're mapped (the mapping stays), so any number of files can be read
+ * 
+ * @param file fileInfo structure of the file
+ */
+extern void mapFile(struct fileInfo *file);
+
+/**
+ * @brief Sets the order in which the files are read, largest first (longest processing time first): the chunks of
+ * the large files are sent while the chunks of the other files can fill the gaps, and the last chunks sent are the
+ * ones of the smallest files, so the workers end together instead of waiting for the last chunks of a large file.
+ * The results are still attributed by the index of the file (the order of the command line). Called after the
+ * files that are in the cache were looked up (the bytes that are left are the ones that count)
+ * 
+ */
+extern void scheduleFiles();
+
+/**
+ * @brief Get the index of the file read at a position of the schedule (set by scheduleFiles())
+ * 
+ * @param position position in the schedule
+ * @return index of the file
+ */
+extern int getScheduledFile(int position);
+
+/**
+ * @brief Unmaps and closes all the files that were mapped by mapFile()
+ * 
+ */
+extern void closeFiles();
+
 /**
  * @brief Get the Chunk object of the current file we're reading
- * Byte for byte reading of the file until the chunk reached the CHUNK_BYTE_LIMIT
- * Finishes if CHUNK_BYTE_LIMIT is reached or if we reach the EOF
- * The function removes word offset bytes from the chunk so that the next chunk can
- * fully read the word
+ * The chunk points to the memory mapped file (no bytes are copied) and has maxBytes bytes
+ * (except at the end of the file). The file isn't inspected: words and UTF-8 sequences cut by the
+ * chunk are put together when the chunk summaries are merged (addChunkSummary())
+ * 
+ * If the workers read the files themselves (parallelIO), only the byte range is set (chunk is NULL)
  * 
+ * The chunks of a stream are read into buffer, with the bytes available (up to maxBytes), so that the
+ * results keep up with a slow stream. A stream ends when it has no bytes left
  * 
  * @param chunkData  fileChunk structure
- * @param rank  of the MPI process
+ * @param maxBytes size of the chunk (at most CHUNK_BYTE_LIMIT bytes)
+ * @param buffer buffer with space for maxBytes bytes, where the chunks of streams are read (NULL if there are no streams)
+ * @return size of the chunk, 0 if all files have been read
  */
-extern unsigned int getChunk(struct fileChunk *chunkData, int rank);
+extern unsigned int getChunk(struct fileChunk *chunkData, unsigned int maxBytes, unsigned char *buffer);
 
+/**
+ * @brief Merges the summary of the byte range that follows the range of left into left (left = left + right)
+ * 
+ * @param left summary of the first range (updated)
+ * @param right summary of the next range
+ */
+extern void mergeSummaries(struct chunkSummary *left, const struct chunkSummary *right);
 
 /**
- * @brief Resets the fileChunk structure
+ * @brief Sets the results of a file once the summaries of all its chunks were merged (in order) into its summary.
+ * The summary itself is kept as it is, so that the bytes appended to the file can still be merged into it (--cache)
+ *
+ * @param file file whose last chunk was merged
+ */
+extern void finishFileSummary(struct fileInfo *file);
+
+/**
+ * @brief Adds the summary of a chunk returned by getChunk() to the results of its file. The chunks may
+ * arrive in any order: they wait (in a circular buffer that grows as needed) until all the chunks sent
+ * before them were merged, and the results of a file are set once its last chunk is merged
+ * 
+ * With --top, the word fragments of the chunk are put together in the same order (mergeWordFragments())
+ * 
+ * @param chunkIndex index of the chunk (set by getChunk())
+ * @param summary summary of the chunk
+ * @param fragments word fragments of the chunk (NULL if it has none)
+ */
+extern void addChunkSummary(unsigned int chunkIndex, const struct chunkSummary *summary, const struct wordFragments *fragments);
+
+
+/**
+ * @brief Resets the fileChunk structure (partial results), keeping its chunk buffer
  * 
  * @param chunkData 
  */
@@ -73,6 +253,13 @@ extern void resetChunkData(struct fileChunk *chunkData);
  */
 extern void getResults();
 
+/**
+ * @brief Prints the results of the chunks of each stream merged so far (running totals)
+ * 
+ * @param elapsed time since the start (in seconds)
+ */
+extern void printRunningTotals(double elapsed);
+
 
 /**
  * @brief Get the Remaining Bytes according to the first byte. Used in the getChunk() method
@@ -83,38 +270,60 @@ extern void getResults();
 extern int getRemainingBytes(int byte);
 
 /**
- * @brief Reads the chunkData->chunkSize bytes belonging to chunkData->chunk and
- * calculates the number of words (numWords) and the number of words with vowels
- * (nWordsWithVowel) of the given chunk
+ * @brief Get the number of bytes of the character that starts at bytes. A sequence that has less
+ * continuation bytes than announced by its first byte is an (invalid) character by itself, so that
+ * any byte that isn't a continuation byte starts a character
  * 
- * @param chunkData 
+ * @param bytes first byte of the character
+ * @param available number of bytes that can be read
+ * @return number of bytes of the character (the announced length if the sequence doesn't fit in the available bytes)
  */
-extern void processChunk(struct fileChunk *chunkData);
+extern int getCharLength(const unsigned char *bytes, unsigned int available);
 
+/**
+ * @brief Processes, with the scalar state machine, the characters of a chunk that start
+ * between the byte indexes start and end, updating the word state and the partial results
+ * (chunkData->summary) of chunkData. Used by the SIMD kernels for multi-byte characters
+ * 
+ * @param chunkData fileChunk structure with the chunk and the partial results
+ * @param state state of the word being read
+ * @param start index of the first byte to process
+ * @param end index where processing stops (a character may extend past it)
+ * @return index of the byte after the last processed character 
+ */
+extern unsigned int processBytes(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
+
+/**
+ * @brief Scalar kernel of processChunk(), decodes and classifies the characters between the byte
+ * indexes start and end with the DFA compiled from the character classes (a table lookup per byte)
+ * 
+ * @param chunkData 
+ * @param state state of the word being read (updated)
+ * @param start index of the first character
+ * @param end index after the last character (no character crosses it)
+ */
+extern void processChunkScalar(struct fileChunk *chunkData, struct wordState *state, unsigned int start, unsigned int end);
 
 /**
- * @brief Retrieves an index which will be used to identify the character ('a','e','i','o','u','y',<separation/whitespace/punctiation>,<other>)
+ * @brief Reads the chunkData->chunkSize bytes belonging to chunkData->chunk (any range of bytes of
+ * a file) and calculates its summary (chunkData->summary): the number of words and the number of
+ * words with vowels after the first separator (counted with the kernel chosen by selectChunkKernel(), or
+ * with the fused kernel of the metrics if there are metrics), the words cut by the ends of the chunk and
+ * the bytes of the UTF-8 sequences cut by them
  * 
- * @param hex Hexadecimal character representation
- * @return 
- *  0 if 'a'
- *  1 if 'e'
- *  2 if 'i'
- *  3 if 'o'
- *  4 if 'u'
- *  5 if 'y'
- *  6 if SEPARATION, WHITESPACE or PUNCTUATION
- * -1 if other character (consonant)
+ * @param chunkData 
  */
-extern int retrieveIndexFromHexadecimal(char* hex);
+extern void processChunk(struct fileChunk *chunkData);
+
 
 /**
- * @brief Resets all wordHasVowels variable to zero
+ * @brief Decodes an UTF-8 sequence into its code point
  * 
- * @param wordHasVowels array of booleans to know if a certain vowel (specified by the index) was already processed in the current word
- * @return void 
+ * @param bytes first byte of the sequence
+ * @param length number of bytes of the sequence (given by getRemainingBytes())
+ * @return code point of the character (UTF8_REPLACEMENT_CHAR if the sequence is invalid) 
  */
-extern void resetWordVowels(bool wordHasVowels[6]);
+extern unsigned int decodeUTF8(const unsigned char *bytes, int length);
 
 
 #endif /* UTILS_H */
\ No newline at end of file
@@ -0,0 +1,534 @@
+/**
+ * @file words.c
+ * @authors Pedro Sobral, Ricardo Rodriguez
+ * @brief Word frequencies and the most frequent words of each file (--top)
+ *
+ * The words are normalised (upper case letters of ASCII and Latin-1 are turned into lower case and every
+ * apostrophe into ') and cut after MAX_WORD_BYTES - 4 bytes. A word is counted when a separator ends it, like
+ * in the word count of the file, so the counts of the words of a file add up to its number of words.
+ *
+ * Each worker counts the words of its chunks in a hash map (open addressing). The words cut by the ends of a
+ * chunk (fragments) go back to the dispatcher with its summary, which puts them together in the order of the
+ * chunks and counts the words they complete in its own map. At the end, the maps of all the ranks are split by
+ * the hash of the words, so that each rank merges the counts of its share of the vocabulary, and the most
+ * frequent words of each file are reduced into rank 0 (the exchanges are done by main.c).
+ *
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "classes.h"
+#include "words.h"
+
+/* Number of files to be processed */
+extern int numFiles;
+
+/* File structure declaration - will be used to store file related data (numWords, etc..) */
+extern struct fileInfo *files;
+
+/**
+ * @brief Hash map of the word counts (open addressing with linear probing, the capacity is a power of 2)
+ *
+ */
+struct wordMap {
+    struct wordCount *entries;
+    size_t capacity;
+    size_t size;
+};
+
+/* Word counts of this rank */
+static struct wordMap wordMap = { NULL, 0, 0 };
+
+
+/**
+ * @brief Get the hash of a word of a file (FNV-1a)
+ *
+ * @param fileIndex index of the file
+ * @param word normalised word
+ * @param length number of bytes of the word
+ * @return hash of the word
+ */
+static uint64_t hashWord(unsigned int fileIndex, const char *word, unsigned int length) {
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    hash = (hash ^ fileIndex) * 0x100000001B3ULL;
+    for (unsigned int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) word[i]) * 0x100000001B3ULL;
+    }
+
+    return hash;
+
+}
+
+
+/**
+ * @brief Adds occurrences of a word to the word map, which doubles its capacity when it's half full
+ *
+ * @param fileIndex index of the file of the word
+ * @param word normalised word
+ * @param length number of bytes of the word
+ * @param count number of occurrences
+ */
+static void addWord(unsigned int fileIndex, const char *word, unsigned int length, uint64_t count) {
+
+    if (2 * (wordMap.size + 1) > wordMap.capacity) {
+
+        struct wordMap map = { NULL, (wordMap.capacity == 0) ? 1024 : 2 * wordMap.capacity, wordMap.size };
+        map.entries = (struct wordCount *) calloc(map.capacity, sizeof(struct wordCount));
+        if (map.entries == NULL) {
+            printf("[ERROR] Can't allocate memory for the word counts\n");
+            exit(1);
+        }
+
+        for (size_t i = 0; i < wordMap.capacity; i++) {
+            struct wordCount *entry = wordMap.entries + i;
+            if (entry->count > 0) {
+                size_t position = hashWord(entry->fileIndex, entry->word, entry->length) & (map.capacity - 1);
+                while (map.entries[position].count > 0) {
+                    position = (position + 1) & (map.capacity - 1);
+                }
+                map.entries[position] = *entry;
+            }
+        }
+
+        free(wordMap.entries);
+        wordMap = map;
+
+    }
+
+    size_t position = hashWord(fileIndex, word, length) & (wordMap.capacity - 1);
+    while (true) {
+        struct wordCount *entry = wordMap.entries + position;
+        if (entry->count == 0) {
+            entry->count = count;
+            entry->fileIndex = fileIndex;
+            entry->length = length;
+            memcpy(entry->word, word, length);
+            wordMap.size++;
+            return;
+        }
+        if (entry->fileIndex == fileIndex && entry->length == length && memcmp(entry->word, word, length) == 0) {
+            entry->count += count;
+            return;
+        }
+        position = (position + 1) & (wordMap.capacity - 1);
+    }
+
+}
+
+
+/**
+ * @brief Frees the word map
+ *
+ */
+static void clearWordMap() {
+
+    free(wordMap.entries);
+    wordMap.entries = NULL;
+    wordMap.capacity = wordMap.size = 0;
+
+}
+
+
+/**
+ * @brief Counts a word ended by a separator, unless it's empty or only has apostrophes (which aren't words)
+ *
+ * @param fileIndex index of the file of the word
+ * @param word normalised word
+ * @param length number of bytes of the word
+ */
+static void endWord(unsigned int fileIndex, const char *word, unsigned int length) {
+
+    for (unsigned int i = 0; i < length; i++) {
+        if (word[i] != '\'') {
+            addWord(fileIndex, word, length, 1);
+            return;
+        }
+    }
+
+}
+
+
+/**
+ * @brief Appends normalised characters to a word. A character is only appended while the word has at most
+ * MAX_WORD_BYTES - 4 bytes, so that a word that is cut is always cut at the same place (wherever it was split)
+ *
+ * @param word normalised word (updated)
+ * @param length number of bytes of the word (updated)
+ * @param bytes normalised characters (valid UTF-8)
+ * @param size number of bytes of the characters
+ */
+static void appendNormalised(char *word, unsigned char *length, const char *bytes, unsigned int size) {
+
+    for (unsigned int i = 0; i < size && *length <= MAX_WORD_BYTES - 4; ) {
+        int charLength = getCharLength((const unsigned char *) bytes + i, size - i);
+        memcpy(word + *length, bytes + i, charLength);
+        *length += charLength;
+        i += charLength;
+    }
+
+}
+
+
+/**
+ * @brief Normalises a character (lower case, ' for every apostrophe) and appends it to a word
+ *
+ * @param word normalised word (updated)
+ * @param length number of bytes of the word (updated)
+ * @param codePoint code point of the character (not a separator)
+ */
+static void appendCharacter(char *word, unsigned char *length, unsigned int codePoint) {
+
+    char bytes[4];
+    unsigned int size;
+
+    /* Most characters are ASCII letters */
+    if (codePoint < 0x80 && codePoint != '`') {
+        if (*length <= MAX_WORD_BYTES - 4) {
+            word[(*length)++] = (codePoint >= 'A' && codePoint <= 'Z') ? codePoint + 'a' - 'A' : codePoint;
+        }
+        return;
+    }
+
+    if (getCharClass(codePoint) == CHAR_CLASS_APOSTROPHE) {
+        codePoint = '\'';
+    } else if (codePoint >= 0xC0 && codePoint <= 0xDE && codePoint != 0xD7) {
+        /* À to Þ (except ×) */
+        codePoint += 0x20;
+    }
+
+    /* UTF-8 encoding of the code point */
+    if (codePoint < 0x80) {
+        bytes[0] = codePoint;
+        size = 1;
+    } else if (codePoint < 0x800) {
+        bytes[0] = 0xC0 | (codePoint >> 6);
+        bytes[1] = 0x80 | (codePoint & 0x3F);
+        size = 2;
+    } else if (codePoint < 0x10000) {
+        bytes[0] = 0xE0 | (codePoint >> 12);
+        bytes[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+        bytes[2] = 0x80 | (codePoint & 0x3F);
+        size = 3;
+    } else {
+        bytes[0] = 0xF0 | (codePoint >> 18);
+        bytes[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+        bytes[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+        bytes[3] = 0x80 | (codePoint & 0x3F);
+        size = 4;
+    }
+
+    appendNormalised(word, length, bytes, size);
+
+}
+
+
+/**
+ * @brief A separator after the fragments of a range: it ends the trailing word of the range (which is counted), or
+ * its lead if the range had no separator yet (which isn't, it may continue a previous range)
+ *
+ * @param fileIndex index of the file of the range
+ * @param fragments word fragments of the range (updated)
+ */
+static void endFragment(unsigned int fileIndex, struct wordFragments *fragments) {
+
+    if (fragments->hasSeparator) {
+        endWord(fileIndex, fragments->trail, fragments->trailSize);
+    }
+    fragments->hasSeparator = true;
+    fragments->trailSize = 0;
+
+}
+
+
+/**
+ * @brief Counts the words of a chunk processed by processChunk() in the word map of this rank.
+ * The words cut by the ends of the chunk are saved in chunkData->fragments
+ *
+ * @param chunkData fileChunk structure with the chunk and its summary
+ */
+void countChunkWords(struct fileChunk *chunkData) {
+
+    struct wordFragments *fragments = &chunkData->fragments;
+    const unsigned char *chunk = chunkData->chunk;
+    unsigned int size = chunkData->chunkSize;
+    char word[MAX_WORD_BYTES];
+    unsigned char length = 0;
+
+    memset(fragments, 0, sizeof(struct wordFragments));
+
+    /* The same characters as processChunk(): the bytes of the characters cut by the chunk are in its summary */
+    unsigned int end = size - chunkData->summary.tailSize;
+    for (unsigned int i = chunkData->summary.headSize; i < end; ) {
+
+        int charLength = getCharLength(chunk + i, size - i);
+        unsigned int codePoint = decodeUTF8(chunk + i, charLength);
+        i += charLength;
+
+        if (getCharClass(codePoint) != CHAR_CLASS_SEPARATOR) {
+            appendCharacter(word, &length, codePoint);
+            continue;
+        }
+
+        /* The word before the first separator continues the one of the previous chunk */
+        if (!fragments->hasSeparator) {
+            memcpy(fragments->lead, word, length);
+            fragments->leadSize = length;
+            fragments->hasSeparator = true;
+        } else {
+            endWord(chunkData->fileIndex, word, length);
+        }
+        length = 0;
+
+    }
+
+    if (fragments->hasSeparator) {
+        memcpy(fragments->trail, word, length);
+        fragments->trailSize = length;
+    } else {
+        memcpy(fragments->lead, word, length);
+        fragments->leadSize = length;
+    }
+
+}
+
+
+/**
+ * @brief Merges the word fragments of the byte range that follows the range of left into left, counting
+ * the words they complete in the word map of this rank. Called before the summaries of the ranges are merged.
+ * The ranges can be anywhere in the file (a node dispatcher merges the slices of a super-chunk): while left has
+ * no separator, its word is the lead of the merged range, which isn't counted (it continues a previous range)
+ *
+ * @param fileIndex index of the file of the ranges
+ * @param left word fragments of the first range (updated)
+ * @param leftSummary summary of the first range (its tail has the start of the character cut by the ranges)
+ * @param right word fragments of the next range
+ * @param rightSummary summary of the next range
+ */
+void mergeWordFragments(unsigned int fileIndex, struct wordFragments *left, const struct chunkSummary *leftSummary,
+                        const struct wordFragments *right, const struct chunkSummary *rightSummary) {
+
+    /* The characters between both ranges (see mergeSummaries()) */
+    unsigned char bytes[6];
+    unsigned int length = leftSummary->tailSize + rightSummary->headSize;
+
+    memcpy(bytes, leftSummary->tail, leftSummary->tailSize);
+    memcpy(bytes + leftSummary->tailSize, rightSummary->head, rightSummary->headSize);
+
+    for (unsigned int i = 0; i < length; ) {
+        unsigned int charLength = getCharLength(bytes + i, length - i);
+        if (charLength > length - i) {
+            charLength = length - i;
+        }
+        unsigned int codePoint = decodeUTF8(bytes + i, charLength);
+        i += charLength;
+
+        if (getCharClass(codePoint) == CHAR_CLASS_SEPARATOR) {
+            endFragment(fileIndex, left);
+        } else if (left->hasSeparator) {
+            appendCharacter(left->trail, &left->trailSize, codePoint);
+        } else {
+            appendCharacter(left->lead, &left->leadSize, codePoint);
+        }
+    }
+
+    /* The word that continues in the next range is the trailing word of left followed by the leading word of right */
+    if (left->hasSeparator) {
+        appendNormalised(left->trail, &left->trailSize, right->lead, right->leadSize);
+    } else {
+        appendNormalised(left->lead, &left->leadSize, right->lead, right->leadSize);
+    }
+    if (right->hasSeparator) {
+        endFragment(fileIndex, left);
+        memcpy(left->trail, right->trail, right->trailSize);
+        left->trailSize = right->trailSize;
+    }
+
+}
+
+
+/**
+ * @brief Moves the word counts of this rank into a buffer, grouped by the part (rank) that merges them, which
+ * is given by the hash of the word. The word map is emptied
+ *
+ * @param numParts number of parts
+ * @param counts number of word counts of each part (set)
+ * @return word counts, part by part (to be freed by the caller)
+ */
+struct wordCount *partitionWordCounts(int numParts, int *counts) {
+
+    int *positions = (int *) calloc(numParts, sizeof(int));
+    struct wordCount *records = (struct wordCount *) malloc((wordMap.size + 1) * sizeof(struct wordCount));
+    if (positions == NULL || records == NULL) {
+        printf("[ERROR] Can't allocate memory for the word counts\n");
+        exit(1);
+    }
+
+    /* The high bits of the hash choose the part (the low ones are the position in the maps) */
+    memset(counts, 0, numParts * sizeof(int));
+    for (size_t i = 0; i < wordMap.capacity; i++) {
+        struct wordCount *entry = wordMap.entries + i;
+        if (entry->count > 0) {
+            counts[(hashWord(entry->fileIndex, entry->word, entry->length) >> 32) % numParts]++;
+        }
+    }
+    for (int p = 1; p < numParts; p++) {
+        positions[p] = positions[p - 1] + counts[p - 1];
+    }
+    for (size_t i = 0; i < wordMap.capacity; i++) {
+        struct wordCount *entry = wordMap.entries + i;
+        if (entry->count > 0) {
+            records[positions[(hashWord(entry->fileIndex, entry->word, entry->length) >> 32) % numParts]++] = *entry;
+        }
+    }
+
+    free(positions);
+    clearWordMap();
+
+    return records;
+
+}
+
+
+/**
+ * @brief Adds word counts (of the same words, possibly) to the word map of this rank
+ *
+ * @param records word counts
+ * @param numRecords number of word counts
+ */
+void addWordCounts(const struct wordCount *records, size_t numRecords) {
+
+    for (size_t i = 0; i < numRecords; i++) {
+        addWord(records[i].fileIndex, records[i].word, records[i].length, records[i].count);
+    }
+
+}
+
+
+/**
+ * @brief Compares two word counts: the most frequent word first, and the words with the same count in
+ * (byte) alphabetical order. The empty entries (count 0) are the last ones
+ *
+ * @param a word count
+ * @param b word count
+ * @return < 0 if a comes first, > 0 if b comes first
+ */
+static int compareWordCounts(const void *a, const void *b) {
+
+    const struct wordCount *x = (const struct wordCount *) a;
+    const struct wordCount *y = (const struct wordCount *) b;
+
+    if (x->count != y->count) {
+        return (x->count > y->count) ? -1 : 1;
+    }
+
+    int order = memcmp(x->word, y->word, (x->length < y->length) ? x->length : y->length);
+    return (order != 0) ? order : x->length - y->length;
+
+}
+
+
+/**
+ * @brief Compares two word counts by file, and then like compareWordCounts()
+ *
+ * @param a word count
+ * @param b word count
+ * @return < 0 if a comes first, > 0 if b comes first
+ */
+static int compareFileWordCounts(const void *a, const void *b) {
+
+    const struct wordCount *x = (const struct wordCount *) a;
+    const struct wordCount *y = (const struct wordCount *) b;
+
+    if (x->fileIndex != y->fileIndex) {
+        return (x->fileIndex < y->fileIndex) ? -1 : 1;
+    }
+
+    return compareWordCounts(a, b);
+
+}
+
+
+/**
+ * @brief Selects the k most frequent words of each file in the word map of this rank (which is freed)
+ *
+ * @param top k word counts per file (numFiles * k), from the most to the least frequent (count 0 if there are less words)
+ * @param k number of words per file
+ */
+void selectTopWords(struct wordCount *top, int k) {
+
+    size_t numWords = 0;
+
+    memset(top, 0, numFiles * k * sizeof(struct wordCount));
+
+    /* The entries in use are moved to the start of the map and sorted by file and frequency */
+    for (size_t i = 0; i < wordMap.capacity; i++) {
+        if (wordMap.entries[i].count > 0) {
+            wordMap.entries[numWords++] = wordMap.entries[i];
+        }
+    }
+    qsort(wordMap.entries, numWords, sizeof(struct wordCount), compareFileWordCounts);
+
+    for (size_t i = 0, rank = 0; i < numWords; i++) {
+        struct wordCount *entry = wordMap.entries + i;
+        rank = (i > 0 && entry->fileIndex == entry[-1].fileIndex) ? rank + 1 : 0;
+        if (rank < (size_t) k) {
+            top[entry->fileIndex * k + rank] = *entry;
+        }
+    }
+
+    clearWordMap();
+
+}
+
+
+/**
+ * @brief Merges two lists of the k most frequent words of each file (inout = top k of inout and in)
+ *
+ * @param inout numFiles * k word counts (updated)
+ * @param in numFiles * k word counts
+ * @param k number of words per file
+ */
+void mergeTopWords(struct wordCount *inout, const struct wordCount *in, int k) {
+
+    struct wordCount merged[MAX_TOP_WORDS];
+
+    /* Each word is counted by a single rank, so the lists never have the same word */
+    for (int f = 0; f < numFiles; f++) {
+        const struct wordCount *x = inout + f * k, *y = in + f * k;
+        for (int i = 0, a = 0, b = 0; i < k; i++) {
+            merged[i] = (compareWordCounts(x + a, y + b) <= 0) ? x[a++] : y[b++];
+        }
+        memcpy(inout + f * k, merged, k * sizeof(struct wordCount));
+    }
+
+}
+
+
+/**
+ * @brief Prints the k most frequent words of each file
+ *
+ * @param top numFiles * k word counts, from the most to the least frequent
+ * @param k number of words per file
+ */
+void printTopWords(const struct wordCount *top, int k) {
+
+    for (int f = 0; f < numFiles; f++) {
+
+        printf("MOST FREQUENT WORDS: %s\n", (files + f)->filename);
+        for (int i = 0; i < k && top[f * k + i].count > 0; i++) {
+            const struct wordCount *entry = top + f * k + i;
+            printf("%4d %12" PRIu64 "  %.*s\n", i + 1, entry->count, entry->length, entry->word);
+        }
+        printf("\n\n");
+
+    }
+
+}
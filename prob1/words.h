@@ -0,0 +1,93 @@
+/**
+ *  \authors Pedro Sobral & Ricardo Rodriguez
+ *
+ *  Header file of the word frequencies and the most frequent words of each file (--top).
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+#ifndef WORDS_H
+#define WORDS_H
+
+/**
+ * @brief Number of occurrences of a (normalised) word in a file. Also the record exchanged by the ranks
+ *
+ */
+struct wordCount {
+    uint64_t count;                 /* 0 if the entry is empty */
+    unsigned int fileIndex;
+    unsigned char length;
+    char word[MAX_WORD_BYTES];      /* Not terminated by '\0' */
+};
+
+/**
+ * @brief Counts the words of a chunk processed by processChunk() in the word map of this rank.
+ * The words cut by the ends of the chunk are saved in chunkData->fragments
+ *
+ * @param chunkData fileChunk structure with the chunk and its summary
+ */
+extern void countChunkWords(struct fileChunk *chunkData);
+
+/**
+ * @brief Merges the word fragments of the byte range that follows the range of left into left, counting
+ * the words they complete in the word map of this rank. Called before the summaries of the ranges are merged.
+ * The ranges can be anywhere in the file (a node dispatcher merges the slices of a super-chunk): while left has
+ * no separator, its word is the lead of the merged range, which isn't counted (it continues a previous range)
+ *
+ * @param fileIndex index of the file of the ranges
+ * @param left word fragments of the first range (updated)
+ * @param leftSummary summary of the first range (its tail has the start of the character cut by the ranges)
+ * @param right word fragments of the next range
+ * @param rightSummary summary of the next range
+ */
+extern void mergeWordFragments(unsigned int fileIndex, struct wordFragments *left, const struct chunkSummary *leftSummary,
+                               const struct wordFragments *right, const struct chunkSummary *rightSummary);
+
+/**
+ * @brief Moves the word counts of this rank into a buffer, grouped by the part (rank) that merges them, which
+ * is given by the hash of the word. The word map is emptied
+ *
+ * @param numParts number of parts
+ * @param counts number of word counts of each part (set)
+ * @return word counts, part by part (to be freed by the caller)
+ */
+extern struct wordCount *partitionWordCounts(int numParts, int *counts);
+
+/**
+ * @brief Adds word counts (of the same words, possibly) to the word map of this rank
+ *
+ * @param records word counts
+ * @param numRecords number of word counts
+ */
+extern void addWordCounts(const struct wordCount *records, size_t numRecords);
+
+/**
+ * @brief Selects the k most frequent words of each file in the word map of this rank (which is freed)
+ *
+ * @param top k word counts per file (numFiles * k), from the most to the least frequent (count 0 if there are less words)
+ * @param k number of words per file
+ */
+extern void selectTopWords(struct wordCount *top, int k);
+
+/**
+ * @brief Merges two lists of the k most frequent words of each file (inout = top k of inout and in)
+ *
+ * @param inout numFiles * k word counts (updated)
+ * @param in numFiles * k word counts
+ * @param k number of words per file
+ */
+extern void mergeTopWords(struct wordCount *inout, const struct wordCount *in, int k);
+
+/**
+ * @brief Prints the k most frequent words of each file
+ *
+ * @param top numFiles * k word counts, from the most to the least frequent
+ * @param k number of words per file
+ */
+extern void printTopWords(const struct wordCount *top, int k);
+
+#endif /* WORDS_H */